@@ -71,6 +71,30 @@ extern void *
 lib_ring_buffer_read_offset_address(struct lib_ring_buffer_backend *bufb,
 				    size_t offset);
 
+/*
+ * Return the address of @offset (masked to the buffer size) in the sub-buffer
+ * pages, and in @pagecpy how many of the @len bytes following it are
+ * contiguous. A RING_BUFFER_VMAP sub-buffer is contiguous as a whole, so a
+ * record, which never crosses a sub-buffer boundary, is always written in one
+ * go.
+ */
+static inline __attribute__((always_inline))
+char *lib_ring_buffer_backend_address(const struct lib_ring_buffer_config *config,
+		struct channel_backend *chanb,
+		struct lib_ring_buffer_backend_pages *backend_pages,
+		size_t offset, size_t len, size_t *pagecpy)
+{
+	size_t index;
+
+	if (config->backend == RING_BUFFER_VMAP) {
+		*pagecpy = len;
+		return backend_pages->virt + (offset & (chanb->subbuf_size - 1));
+	}
+	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
+	*pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	return backend_pages->p[index].virt + (offset & ~PAGE_MASK);
+}
+
 /**
  * lib_ring_buffer_write - write data to a buffer backend
  * @config : ring buffer instance configuration
@@ -90,7 +114,8 @@ void lib_ring_buffer_write(const struct lib_ring_buffer_config *config,
 {
 	struct lib_ring_buffer_backend *bufb = &ctx->buf->backend;
 	struct channel_backend *chanb = &ctx->chan->backend;
-	size_t index, pagecpy;
+	size_t pagecpy;
+	char *dest;
 	size_t offset = ctx->buf_offset;
 	struct lib_ring_buffer_backend_pages *backend_pages;
 
@@ -98,14 +123,11 @@ void lib_ring_buffer_write(const struct lib_ring_buffer_config *config,
 		return;
 	backend_pages =
 		lib_ring_buffer_get_backend_pages_from_ctx(config, ctx);
-	offset &= chanb->buf_size - 1;
-	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
-	pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	offset &= bufb->buf_size - 1;
+	dest = lib_ring_buffer_backend_address(config, chanb, backend_pages,
+					       offset, len, &pagecpy);
 	if (likely(pagecpy == len))
-		lib_ring_buffer_do_copy(config,
-					backend_pages->p[index].virt
-					    + (offset & ~PAGE_MASK),
-					src, len);
+		lib_ring_buffer_do_copy(config, dest, src, len);
 	else
 		_lib_ring_buffer_write(bufb, offset, src, len, 0);
 	ctx->buf_offset += len;
@@ -131,7 +153,8 @@ void lib_ring_buffer_memset(const struct lib_ring_buffer_config *config,
 
 	struct lib_ring_buffer_backend *bufb = &ctx->buf->backend;
 	struct channel_backend *chanb = &ctx->chan->backend;
-	size_t index, pagecpy;
+	size_t pagecpy;
+	char *dest;
 	size_t offset = ctx->buf_offset;
 	struct lib_ring_buffer_backend_pages *backend_pages;
 
@@ -139,13 +162,11 @@ void lib_ring_buffer_memset(const struct lib_ring_buffer_config *config,
 		return;
 	backend_pages =
 		lib_ring_buffer_get_backend_pages_from_ctx(config, ctx);
-	offset &= chanb->buf_size - 1;
-	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
-	pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	offset &= bufb->buf_size - 1;
+	dest = lib_ring_buffer_backend_address(config, chanb, backend_pages,
+					       offset, len, &pagecpy);
 	if (likely(pagecpy == len))
-		lib_ring_buffer_do_memset(backend_pages->p[index].virt
-					  + (offset & ~PAGE_MASK),
-					  c, len);
+		lib_ring_buffer_do_memset(dest, c, len);
 	else
 		_lib_ring_buffer_memset(bufb, offset, c, len, 0);
 	ctx->buf_offset += len;
@@ -228,7 +249,8 @@ void lib_ring_buffer_strcpy(const struct lib_ring_buffer_config *config,
 {
 	struct lib_ring_buffer_backend *bufb = &ctx->buf->backend;
 	struct channel_backend *chanb = &ctx->chan->backend;
-	size_t index, pagecpy;
+	size_t pagecpy;
+	char *dest;
 	size_t offset = ctx->buf_offset;
 	struct lib_ring_buffer_backend_pages *backend_pages;
 
@@ -236,30 +258,24 @@ void lib_ring_buffer_strcpy(const struct lib_ring_buffer_config *config,
 		return;
 	backend_pages =
 		lib_ring_buffer_get_backend_pages_from_ctx(config, ctx);
-	offset &= chanb->buf_size - 1;
-	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
-	pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	offset &= bufb->buf_size - 1;
+	dest = lib_ring_buffer_backend_address(config, chanb, backend_pages,
+					       offset, len, &pagecpy);
 	if (likely(pagecpy == len)) {
 		size_t count;
 
 		count = lib_ring_buffer_do_strcpy(config,
-					backend_pages->p[index].virt
-					    + (offset & ~PAGE_MASK),
-					src, len - 1);
-		offset += count;
+					dest, src, len - 1);
+		dest += count;
 		/* Padding */
 		if (unlikely(count < len - 1)) {
 			size_t pad_len = len - 1 - count;
 
-			lib_ring_buffer_do_memset(backend_pages->p[index].virt
-						+ (offset & ~PAGE_MASK),
-					pad, pad_len);
-			offset += pad_len;
+			lib_ring_buffer_do_memset(dest, pad, pad_len);
+			dest += pad_len;
 		}
 		/* Ending '\0' */
-		lib_ring_buffer_do_memset(backend_pages->p[index].virt
-					+ (offset & ~PAGE_MASK),
-				'\0', 1);
+		lib_ring_buffer_do_memset(dest, '\0', 1);
 	} else {
 		_lib_ring_buffer_strcpy(bufb, offset, src, len, 0, pad);
 	}
@@ -286,7 +302,8 @@ void lib_ring_buffer_copy_from_user_inatomic(const struct lib_ring_buffer_config
 {
 	struct lib_ring_buffer_backend *bufb = &ctx->buf->backend;
 	struct channel_backend *chanb = &ctx->chan->backend;
-	size_t index, pagecpy;
+	size_t pagecpy;
+	char *dest;
 	size_t offset = ctx->buf_offset;
 	struct lib_ring_buffer_backend_pages *backend_pages;
 	unsigned long ret;
@@ -296,9 +313,9 @@ void lib_ring_buffer_copy_from_user_inatomic(const struct lib_ring_buffer_config
 		return;
 	backend_pages =
 		lib_ring_buffer_get_backend_pages_from_ctx(config, ctx);
-	offset &= chanb->buf_size - 1;
-	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
-	pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	offset &= bufb->buf_size - 1;
+	dest = lib_ring_buffer_backend_address(config, chanb, backend_pages,
+					       offset, len, &pagecpy);
 
 	set_fs(KERNEL_DS);
 	pagefault_disable();
@@ -306,8 +323,7 @@ void lib_ring_buffer_copy_from_user_inatomic(const struct lib_ring_buffer_config
 		goto fill_buffer;
 
 	if (likely(pagecpy == len)) {
-		ret = lib_ring_buffer_do_copy_from_user_inatomic(
-			backend_pages->p[index].virt + (offset & ~PAGE_MASK),
+		ret = lib_ring_buffer_do_copy_from_user_inatomic(dest,
 			src, len);
 		if (unlikely(ret > 0)) {
 			/* Copy failed. */
@@ -357,7 +373,8 @@ void lib_ring_buffer_strcpy_from_user_inatomic(const struct lib_ring_buffer_conf
 {
 	struct lib_ring_buffer_backend *bufb = &ctx->buf->backend;
 	struct channel_backend *chanb = &ctx->chan->backend;
-	size_t index, pagecpy;
+	size_t pagecpy;
+	char *dest;
 	size_t offset = ctx->buf_offset;
 	struct lib_ring_buffer_backend_pages *backend_pages;
 	mm_segment_t old_fs = get_fs();
@@ -366,9 +383,9 @@ void lib_ring_buffer_strcpy_from_user_inatomic(const struct lib_ring_buffer_conf
 		return;
 	backend_pages =
 		lib_ring_buffer_get_backend_pages_from_ctx(config, ctx);
-	offset &= chanb->buf_size - 1;
-	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
-	pagecpy = min_t(size_t, len, (-offset) & ~PAGE_MASK);
+	offset &= bufb->buf_size - 1;
+	dest = lib_ring_buffer_backend_address(config, chanb, backend_pages,
+					       offset, len, &pagecpy);
 
 	set_fs(KERNEL_DS);
 	pagefault_disable();
@@ -379,23 +396,17 @@ void lib_ring_buffer_strcpy_from_user_inatomic(const struct lib_ring_buffer_conf
 		size_t count;
 
 		count = lib_ring_buffer_do_strcpy_from_user_inatomic(config,
-					backend_pages->p[index].virt
-					    + (offset & ~PAGE_MASK),
-					src, len - 1);
-		offset += count;
+					dest, src, len - 1);
+		dest += count;
 		/* Padding */
 		if (unlikely(count < len - 1)) {
 			size_t pad_len = len - 1 - count;
 
-			lib_ring_buffer_do_memset(backend_pages->p[index].virt
-						+ (offset & ~PAGE_MASK),
-					pad, pad_len);
-			offset += pad_len;
+			lib_ring_buffer_do_memset(dest, pad, pad_len);
+			dest += pad_len;
 		}
 		/* Ending '\0' */
-		lib_ring_buffer_do_memset(backend_pages->p[index].virt
-					+ (offset & ~PAGE_MASK),
-				'\0', 1);
+		lib_ring_buffer_do_memset(dest, '\0', 1);
 	} else {
 		_lib_ring_buffer_strcpy_from_user_inatomic(bufb, offset, src,
 					len, 0, pad);
@@ -433,7 +444,7 @@ unsigned long lib_ring_buffer_get_records_unread(
 	unsigned long records_unread = 0, sb_bindex, id;
 	unsigned int i;
 
-	for (i = 0; i < bufb->chan->backend.num_subbuf; i++) {
+	for (i = 0; i < bufb->num_subbuf; i++) {
 		id = bufb->buf_wsb[i].id;
 		sb_bindex = subbuffer_id_get_index(config, id);
 		pages = bufb->array[sb_bindex];
@@ -448,6 +459,31 @@ unsigned long lib_ring_buffer_get_records_unread(
 	return records_unread;
 }
 
+/*
+ * Splice page pool accessors. Count the replacement pages taken from the
+ * pool (hit) and freshly allocated (miss) by splice. Return 0 for buffers
+ * without page pool.
+ */
+static inline
+unsigned long lib_ring_buffer_get_page_pool_hit(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	struct lib_ring_buffer_page_pool *pool = buf->backend.page_pool;
+
+	return pool ? ACCESS_ONCE(pool->hit) : 0;
+}
+
+static inline
+unsigned long lib_ring_buffer_get_page_pool_miss(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	struct lib_ring_buffer_page_pool *pool = buf->backend.page_pool;
+
+	return pool ? ACCESS_ONCE(pool->miss) : 0;
+}
+
 /*
  * We use __copy_from_user_inatomic to copy userspace data after
  * checking with access_ok() and disabling page faults.
@@ -37,11 +37,20 @@ int lib_ring_buffer_backend_create(struct lib_ring_buffer_backend *bufb,
 				   struct channel_backend *chan, int cpu);
 void channel_backend_unregister_notifiers(struct channel_backend *chanb);
 void lib_ring_buffer_backend_free(struct lib_ring_buffer_backend *bufb);
+int lib_ring_buffer_backend_resize_alloc(struct lib_ring_buffer_backend *new_bufb,
+					 struct lib_ring_buffer_backend *bufb,
+					 size_t num_subbuf);
+void lib_ring_buffer_backend_resize_free(struct lib_ring_buffer_backend *new_bufb);
+void lib_ring_buffer_backend_resize_install(struct lib_ring_buffer_backend *bufb,
+					    struct lib_ring_buffer_backend *new_bufb,
+					    unsigned long begin,
+					    unsigned long end);
 int channel_backend_init(struct channel_backend *chanb,
 			 const char *name,
 			 const struct lib_ring_buffer_config *config,
 			 void *priv, size_t subbuf_size,
-			 size_t num_subbuf);
+			 size_t num_subbuf, unsigned int num_reader_subbuf,
+			 int lazy_alloc);
 void channel_backend_free(struct channel_backend *chanb);
 
 void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb);
@@ -50,6 +59,21 @@ void channel_backend_reset(struct channel_backend *chanb);
 int lib_ring_buffer_backend_init(void);
 void lib_ring_buffer_backend_exit(void);
 
+/* RING_BUFFER_STATIC region */
+
+int lib_ring_buffer_static_init(void);
+void lib_ring_buffer_static_exit(void);
+int lib_ring_buffer_static_alloc_pages(struct page **pages,
+				       unsigned long nr_pages);
+void lib_ring_buffer_static_free_page(struct page *page);
+
+/* Splice replacement page pool */
+
+struct page *
+lib_ring_buffer_page_pool_alloc(struct lib_ring_buffer_page_pool *pool);
+void lib_ring_buffer_page_pool_recycle(struct lib_ring_buffer_page_pool *pool,
+				       struct page *page);
+
 extern void _lib_ring_buffer_write(struct lib_ring_buffer_backend *bufb,
 				   size_t offset, const void *src, size_t len,
 				   size_t pagecpy);
@@ -98,6 +122,19 @@ extern void _lib_ring_buffer_strcpy_from_user_inatomic(struct lib_ring_buffer_ba
 #define SB_ID_INDEX_COUNT	(1UL << SB_ID_INDEX_SHIFT)
 #define SB_ID_INDEX_MASK	(SB_ID_NOREF_COUNT - 1)
 
+/*
+ * Memory node of the buffer of @cpu: the node of the cpu, node of cpu 0 for a
+ * global buffer (cpu -1), or @cpu itself for per-node buffers.
+ */
+static inline
+int lib_ring_buffer_cpu_to_node(const struct lib_ring_buffer_config *config,
+				int cpu)
+{
+	if (config->alloc == RING_BUFFER_ALLOC_PER_NODE)
+		return cpu;
+	return cpu_to_node(max(cpu, 0));
+}
+
 /*
  * Construct the subbuffer id from offset, index and noref. Use only the index
  * for producer-consumer mode (offset and noref are only used in overwrite
@@ -201,6 +238,23 @@ int subbuffer_id_check_index(const struct lib_ring_buffer_config *config,
 		return 0;
 }
 
+/*
+ * Initial sub-buffer id of reader slot @slot. In overwrite mode, each reader
+ * slot owns one of the extra reader sub-buffers allocated after the writer
+ * sub-buffers. In discard mode, the reader uses the writer pages directly.
+ */
+static inline
+unsigned long lib_ring_buffer_backend_reader_slot_id(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer_backend *bufb,
+				unsigned int slot)
+{
+	if (bufb->chan->backend.extra_reader_sb)
+		return subbuffer_id(config, 0, 1, bufb->num_subbuf + slot);
+	else
+		return subbuffer_id(config, 0, 1, 0);
+}
+
 static inline
 void lib_ring_buffer_backend_get_pages(const struct lib_ring_buffer_config *config,
 			struct lib_ring_buffer_ctx *ctx,
@@ -212,7 +266,7 @@ void lib_ring_buffer_backend_get_pages(const struct lib_ring_buffer_config *conf
 	unsigned long sb_bindex, id;
 	struct lib_ring_buffer_backend_pages *rpages;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	sbidx = offset >> chanb->subbuf_size_order;
 	id = bufb->buf_wsb[sbidx].id;
 	sb_bindex = subbuffer_id_get_index(config, id);
@@ -361,6 +415,19 @@ void subbuffer_inc_packet_count(const struct lib_ring_buffer_config *config,
 	bufb->buf_cnt[idx].seq_cnt++;
 }
 
+/*
+ * Set before the packet counter is incremented, see
+ * lib_ring_buffer_snapshot_since().
+ */
+static inline
+void subbuffer_set_timestamp_end(const struct lib_ring_buffer_config *config,
+				 struct lib_ring_buffer_backend *bufb,
+				 unsigned long idx, u64 tsc)
+{
+	bufb->buf_cnt[idx].timestamp_end = tsc;
+	smp_wmb();
+}
+
 /**
  * lib_ring_buffer_clear_noref - Clear the noref subbuffer flag, called by
  *                               writer.
@@ -25,6 +25,9 @@
 
 #include <linux/cpumask.h>
 #include <linux/types.h>
+#include <linux/kref.h>
+#include <linux/spinlock.h>
+#include <linux/cache.h>
 #include <lttng-kernel-version.h>
 #include <lttng-cpuhotplug.h>
 
@@ -38,6 +41,10 @@ struct lib_ring_buffer_backend_pages {
 	union v_atomic records_commit;	/* current records committed count */
 	union v_atomic records_unread;	/* records to read */
 	unsigned long data_size;	/* Amount of data to read from subbuf */
+	void *virt;			/*
+					 * Contiguous mapping of the pages
+					 * (RING_BUFFER_VMAP only)
+					 */
 	struct lib_ring_buffer_backend_page p[];
 };
 
@@ -54,6 +61,24 @@ struct lib_ring_buffer_backend_counts {
 	 * subbuf_idx.
 	 */
 	uint64_t seq_cnt;		/* packet sequence number */
+	uint64_t timestamp_end;		/* end of the last packet delivered */
+};
+
+/*
+ * Pool of pages recycled between the splice pipe and the buffer. Pages
+ * moved into a pipe are replaced by pages taken from this pool, and are
+ * given back to it when the pipe releases them. Each page in flight in a
+ * pipe holds a reference on the pool, so it may outlive its buffer.
+ */
+struct lib_ring_buffer_page_pool {
+	spinlock_t lock;		/* protects pages, nr_pages, hit, miss */
+	struct kref ref;		/* buffer + pages in flight */
+	int node;			/* NUMA node of the buffer */
+	unsigned int nr_pages;		/* number of pages in pool */
+	unsigned int max_pages;		/* pool capacity */
+	unsigned long hit;		/* replacement pages taken from pool */
+	unsigned long miss;		/* replacement pages allocated */
+	struct page *pages[];
 };
 
 /*
@@ -63,10 +88,19 @@ struct channel;
 struct lib_ring_buffer;
 
 struct lib_ring_buffer_backend {
+	/*
+	 * Geometry of this buffer. Starts as the channel one, changed by
+	 * channel_resize() while the buffer writers are stopped.
+	 */
+	unsigned long buf_size;		/* Size of the buffer */
+	unsigned long num_subbuf;	/* Number of sub-buffers for writer */
+	unsigned int buf_size_order;	/* Order of buffer size */
+	unsigned int num_subbuf_order;	/*
+					 * Order of number of sub-buffers/buffer
+					 * for writer.
+					 */
 	/* Array of ring_buffer_backend_subbuffer for writer */
 	struct lib_ring_buffer_backend_subbuffer *buf_wsb;
-	/* ring_buffer_backend_subbuffer for reader */
-	struct lib_ring_buffer_backend_subbuffer buf_rsb;
 	/* Array of lib_ring_buffer_backend_counts for the packet counter */
 	struct lib_ring_buffer_backend_counts *buf_cnt;
 	/*
@@ -75,13 +109,27 @@ struct lib_ring_buffer_backend {
 	 */
 	struct lib_ring_buffer_backend_pages **array;
 	unsigned int num_pages_per_subbuf;
+	/* Splice replacement page pool (RING_BUFFER_SPLICE only) */
+	struct lib_ring_buffer_page_pool *page_pool;
 
 	struct channel *chan;		/* Associated channel */
 	int cpu;			/* This buffer's cpu. -1 if global. */
-	union v_atomic records_read;	/* Number of records read */
 	unsigned int allocated:1;	/* is buffer allocated ? */
+
+	/*
+	 * Updated by the reader: kept away from the fields the writer reads
+	 * on each record.
+	 */
+	/* ring_buffer_backend_subbuffer for reader */
+	struct lib_ring_buffer_backend_subbuffer buf_rsb
+					____cacheline_aligned_in_smp;
+	union v_atomic records_read;	/* Number of records read */
 };
 
+/*
+ * buf_size, num_subbuf and their orders are the geometry of the buffers
+ * allocated from now on: each buffer keeps its own, see channel_resize().
+ */
 struct channel_backend {
 	unsigned long buf_size;		/* Size of the buffer */
 	unsigned long subbuf_size;	/* Sub-buffer size */
@@ -91,7 +139,15 @@ struct channel_backend {
 					 * for writer.
 					 */
 	unsigned int buf_size_order;	/* Order of buffer size */
-	unsigned int extra_reader_sb:1;	/* has extra reader subbuffer ? */
+	unsigned int extra_reader_sb;	/* Number of extra reader subbuffers */
+	unsigned int num_reader_sb;	/*
+					 * Number of sub-buffers the reader
+					 * can hold at once
+					 */
+	int lazy_alloc;			/*
+					 * Per-cpu buffers allocated on their
+					 * first record
+					 */
 	struct lib_ring_buffer *buf;	/* Channel per-cpu buffers */
 
 	unsigned long num_subbuf;	/* Number of sub-buffers for writer */
@@ -96,6 +96,13 @@ struct lib_ring_buffer_client_cb {
  *   Per-cpu buffer with global synchronization. Tracing can be performed with
  *   preemption enabled, statistically stays on the local buffers.
  *
+ * RING_BUFFER_ALLOC_PER_NODE and RING_BUFFER_SYNC_GLOBAL :
+ *   One buffer per NUMA node, shared by the cpus of the node with global
+ *   synchronization. Uses far less memory than per-cpu buffers on large
+ *   systems, at the cost of some cmpxchg contention, while keeping writes
+ *   node-local. Buffers are designated by their node wherever the API takes a
+ *   cpu, and only nodes with cpus at channel creation get a buffer.
+ *
  * RING_BUFFER_ALLOC_GLOBAL and RING_BUFFER_SYNC_PER_CPU :
  *   Should only be used for buffers belonging to a single thread or protected
  *   by mutual exclusion by the client. Note that periodical sub-buffer switch
@@ -117,11 +124,24 @@ struct lib_ring_buffer_client_cb {
  *
  * RING_BUFFER_WAKEUP_NONE does not perform any wakeup whatsoever. The client
  * has the responsibility to perform wakeups.
+ *
+ * page_order:
+ *
+ * RING_BUFFER_PAGE_ORDER_0 allocates buffer pages one by one.
+ *
+ * RING_BUFFER_PAGE_HIGH_ORDER backs each sub-buffer with physically contiguous
+ * chunks of pages, up to the whole sub-buffer, so a sub-buffer spans few
+ * memory ranges rather than pages scattered over memory, and large buffers
+ * take fewer allocations. Allocation falls back to smaller chunks, down to
+ * single pages, when memory is too fragmented. The chunks are split into
+ * order-0 pages, which the backend keeps addressing one by one: the write
+ * path and the mappings are the same as with RING_BUFFER_PAGE_ORDER_0.
  */
 struct lib_ring_buffer_config {
 	enum {
 		RING_BUFFER_ALLOC_PER_CPU,
 		RING_BUFFER_ALLOC_GLOBAL,
+		RING_BUFFER_ALLOC_PER_NODE,
 	} alloc;
 	enum {
 		RING_BUFFER_SYNC_PER_CPU,	/* Wait-free */
@@ -134,15 +154,19 @@ struct lib_ring_buffer_config {
 	enum {
 		RING_BUFFER_SPLICE,
 		RING_BUFFER_MMAP,
-		RING_BUFFER_READ,		/* TODO */
+		RING_BUFFER_READ,		/* read() of whole packets */
 		RING_BUFFER_ITERATOR,
 		RING_BUFFER_NONE,
 	} output;
 	enum {
 		RING_BUFFER_PAGE,
-		RING_BUFFER_VMAP,		/* TODO */
-		RING_BUFFER_STATIC,		/* TODO */
+		RING_BUFFER_VMAP,		/* Sub-buffers vmap'd, not with splice */
+		RING_BUFFER_STATIC,		/* Pages from a reserved region */
 	} backend;
+	enum {
+		RING_BUFFER_PAGE_ORDER_0,
+		RING_BUFFER_PAGE_HIGH_ORDER,	/* Contiguous when available */
+	} page_order;
 	enum {
 		RING_BUFFER_NO_OOPS_CONSISTENCY,
 		RING_BUFFER_OOPS_CONSISTENCY,
@@ -238,12 +262,20 @@ void lib_ring_buffer_ctx_init(struct lib_ring_buffer_ctx *ctx,
  * needed in the record header. If this flag is not set, the record header needs
  * only to contain "tsc_bits" bit of time value.
  *
+ * RING_BUFFER_RFLAG_HIGH_PRIO
+ *
+ * Set by the client before lib_ring_buffer_reserve(). In discard mode, once the
+ * unconsumed data of a buffer reaches the channel priority watermark, only
+ * records carrying this flag are still accepted, so the remaining space is kept
+ * for them. See channel_set_prio_watermark().
+ *
  * Reservation flags can be added by the client, starting from
  * "(RING_BUFFER_FLAGS_END << 0)". It can be used to pass information from
  * record_header_size() to lib_ring_buffer_write_record_header().
  */
 #define	RING_BUFFER_RFLAG_FULL_TSC		(1U << 0)
-#define RING_BUFFER_RFLAG_END			(1U << 1)
+#define RING_BUFFER_RFLAG_HIGH_PRIO		(1U << 1)
+#define RING_BUFFER_RFLAG_END			(1U << 2)
 
 #ifndef LTTNG_TRACER_CORE_H
 #error "lttng-tracer-core.h is needed for RING_BUFFER_ALIGN define"
@@ -310,6 +342,9 @@ int lib_ring_buffer_check_config(const struct lib_ring_buffer_config *config,
 	    && config->sync == RING_BUFFER_SYNC_PER_CPU
 	    && switch_timer_interval)
 		return -EINVAL;
+	if (config->alloc == RING_BUFFER_ALLOC_PER_NODE
+	    && config->sync != RING_BUFFER_SYNC_GLOBAL)
+		return -EINVAL;
 	return 0;
 }
 
@@ -59,6 +59,9 @@
  *
  * read_timer_interval is the time interval (in us) to wake up pending readers.
  *
+ * num_reader_subbuf is the number of sub-buffers the reader can hold at once
+ * (0 is the same as 1).
+ *
  * buf_addr is a pointer the the beginning of the preallocated buffer contiguous
  * address mapping. It is used only by RING_BUFFER_STATIC configuration. It can
  * be set to NULL for other backends.
@@ -69,6 +72,8 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 			       const char *name, void *priv,
 			       void *buf_addr,
 			       size_t subbuf_size, size_t num_subbuf,
+			       unsigned int num_reader_subbuf,
+			       int lazy_alloc,
 			       unsigned int switch_timer_interval,
 			       unsigned int read_timer_interval);
 
@@ -80,6 +85,14 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 extern
 void *channel_destroy(struct channel *chan);
 
+/*
+ * channel_resize changes the number of sub-buffers of each channel buffer,
+ * one buffer at a time. The buffer readers install the new memory, keeping
+ * the data not consumed yet.
+ */
+extern
+int channel_resize(struct channel *chan, size_t num_subbuf);
+
 
 /* Buffer read operations */
 
@@ -94,18 +107,33 @@ void *channel_destroy(struct channel *chan);
 		({ (cpu) = cpumask_next(cpu, (chan)->backend.cpumask);	\
 		   smp_read_barrier_depends(); (cpu) < nr_cpu_ids; });)
 
+/* Per-node buffers are tracked by node in the channel cpumask. */
+#define for_each_channel_node(node, chan)				\
+	for_each_channel_cpu(node, chan)
+
 extern struct lib_ring_buffer *channel_get_ring_buffer(
 				const struct lib_ring_buffer_config *config,
 				struct channel *chan, int cpu);
 extern int lib_ring_buffer_open_read(struct lib_ring_buffer *buf);
 extern void lib_ring_buffer_release_read(struct lib_ring_buffer *buf);
 
+/*
+ * Fill a bitmap of the channel buffers which have a sub-buffer ready to be
+ * consumed. Returns the number of such buffers.
+ */
+extern int channel_poll_deliver_mask(struct channel *chan,
+				     unsigned long *mask);
+
 /*
  * Read sequence: snapshot, many get_subbuf/put_subbuf, move_consumer.
  */
 extern int lib_ring_buffer_snapshot(struct lib_ring_buffer *buf,
 				    unsigned long *consumed,
 				    unsigned long *produced);
+extern int lib_ring_buffer_snapshot_since(struct lib_ring_buffer *buf,
+					  u64 since,
+					  unsigned long *consumed,
+					  unsigned long *produced);
 extern void lib_ring_buffer_move_consumer(struct lib_ring_buffer *buf,
 					  unsigned long consumed_new);
 
@@ -113,6 +141,63 @@ extern int lib_ring_buffer_get_subbuf(struct lib_ring_buffer *buf,
 				      unsigned long consumed);
 extern void lib_ring_buffer_put_subbuf(struct lib_ring_buffer *buf);
 
+/*
+ * Reader slots: when the channel is created with more than one reader
+ * sub-buffer, the reader can hold several consecutive sub-buffers at once.
+ * get_subbuf/put_subbuf and the accessors of the sub-buffer being read apply
+ * to the selected slot.
+ */
+extern int lib_ring_buffer_get_next_subbuf_slot(struct lib_ring_buffer *buf,
+						unsigned int *slot);
+extern int lib_ring_buffer_select_subbuf_slot(struct lib_ring_buffer *buf,
+					      unsigned int slot);
+extern int lib_ring_buffer_put_subbuf_slot(struct lib_ring_buffer *buf,
+					   unsigned int slot);
+extern int lib_ring_buffer_reader_slots_busy(struct lib_ring_buffer *buf);
+
+/*
+ * Overwrite mode: get the oldest readable sub-buffers into the free reader
+ * slots in one call, up to the number of reader slots, writers going on into
+ * the slots spare sub-buffers.
+ */
+extern int lib_ring_buffer_get_subbuf_slots(struct lib_ring_buffer *buf,
+					    unsigned int *count);
+
+/*
+ * Live reads: read the committed prefix of the packet under the write head,
+ * without waiting for the sub-buffer to be delivered (discard mode only).
+ */
+extern int lib_ring_buffer_live_read(struct lib_ring_buffer *buf,
+				     char __user *user_buf, size_t len,
+				     unsigned long *packet_offset,
+				     size_t *copied, int *packet_end);
+
+/*
+ * Consumer position page: the consumer publishes its consumed position in a
+ * shared page, which replaces put_subbuf/move_consumer. See
+ * RING_BUFFER_ENABLE_CONSUMER_PAGE.
+ */
+extern int lib_ring_buffer_enable_consumer_page(struct lib_ring_buffer *buf);
+extern void lib_ring_buffer_consumer_page_put(struct lib_ring_buffer *buf);
+
+/*
+ * Packet index ring: the client appends one entry per delivered packet, which
+ * the consumer reads in bulk or through mmap. See
+ * RING_BUFFER_ENABLE_PACKET_INDEX.
+ */
+extern int lib_ring_buffer_enable_packet_index(struct lib_ring_buffer *buf);
+extern void lib_ring_buffer_packet_index_append(struct lib_ring_buffer *buf,
+		const struct lib_ring_buffer_packet_index *entry);
+extern int lib_ring_buffer_read_packet_index(struct lib_ring_buffer *buf,
+		struct lib_ring_buffer_packet_index __user *entries,
+		unsigned int count, unsigned int *nr_read);
+
+static inline
+int lib_ring_buffer_packet_index_enabled(struct lib_ring_buffer *buf)
+{
+	return ACCESS_ONCE(buf->packet_index) != NULL;
+}
+
 void lib_ring_buffer_set_quiescent_channel(struct channel *chan);
 void lib_ring_buffer_clear_quiescent_channel(struct channel *chan);
 
@@ -124,6 +209,8 @@ static inline int lib_ring_buffer_get_next_subbuf(struct lib_ring_buffer *buf)
 {
 	int ret;
 
+	if (buf->consumer_page)
+		lib_ring_buffer_consumer_page_put(buf);
 	ret = lib_ring_buffer_snapshot(buf, &buf->cons_snapshot,
 				       &buf->prod_snapshot);
 	if (ret)
@@ -184,6 +271,39 @@ int lib_ring_buffer_channel_is_disabled(const struct channel *chan)
 	return atomic_read(&chan->record_disabled);
 }
 
+/*
+ * Overwrite mode: packets ending more than @max_age (ring buffer clock units)
+ * before the current time are dropped from the readable data, by the switch
+ * timer and by snapshots. 0 keeps whatever fits in the buffer.
+ */
+static inline
+void channel_set_retention(struct channel *chan, u64 max_age)
+{
+	ACCESS_ONCE(chan->retention) = max_age;
+}
+
+/*
+ * Discard mode: once @watermark bytes of a buffer are not consumed yet, records
+ * without RING_BUFFER_RFLAG_HIGH_PRIO are refused, keeping the rest of the
+ * buffer for high priority records. 0 disables the watermark.
+ */
+static inline
+void channel_set_prio_watermark(struct channel *chan, unsigned long watermark)
+{
+	ACCESS_ONCE(chan->prio_watermark) = watermark;
+}
+
+/*
+ * Length of the mmap of one buffer: the writer sub-buffers, plus the
+ * reader sub-buffers if any.
+ */
+static inline
+unsigned long channel_get_mmap_buf_len(const struct channel *chan)
+{
+	return chan->backend.buf_size
+		+ chan->backend.extra_reader_sb * chan->backend.subbuf_size;
+}
+
 static inline
 unsigned long lib_ring_buffer_get_read_data_size(
 				const struct lib_ring_buffer_config *config,
@@ -232,6 +352,38 @@ unsigned long lib_ring_buffer_get_records_lost_big(
 	return v_read(config, &buf->records_lost_big);
 }
 
+static inline
+unsigned long lib_ring_buffer_get_records_lost_prio(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	return v_read(config, &buf->records_lost_prio);
+}
+
+static inline
+unsigned long lib_ring_buffer_get_records_lost_full_high(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	return v_read(config, &buf->records_lost_full_high);
+}
+
+static inline
+unsigned long lib_ring_buffer_get_records_lost_alloc(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	return v_read(config, &buf->records_lost_alloc);
+}
+
+static inline
+unsigned long lib_ring_buffer_get_records_lost_resize(
+				const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer *buf)
+{
+	return v_read(config, &buf->records_lost_resize);
+}
+
 static inline
 unsigned long lib_ring_buffer_get_records_read(
 				const struct lib_ring_buffer_config *config,
@@ -104,7 +104,7 @@ int lib_ring_buffer_try_reserve(const struct lib_ring_buffer_config *config,
 	 * commit counter to increment it and commit seq value to compare it to
 	 * the commit counter.
 	 */
-	prefetch(&buf->commit_hot[subbuf_index(*o_begin, chan)]);
+	prefetch(&buf->commit_hot[subbuf_index(*o_begin, buf)]);
 
 	if (last_tsc_overflow(config, buf, ctx->tsc))
 		ctx->rflags |= RING_BUFFER_RFLAG_FULL_TSC;
@@ -137,6 +137,40 @@ int lib_ring_buffer_try_reserve(const struct lib_ring_buffer_config *config,
 	return 0;
 }
 
+/*
+ * lib_ring_buffer_prio_reject is called by lib_ring_buffer_reserve(). It is not
+ * part of the API per se.
+ *
+ * Discard mode: refuse records without RING_BUFFER_RFLAG_HIGH_PRIO while the
+ * unconsumed data is above the channel priority watermark. The pressure hint is
+ * set by the writer when it moves into a new sub-buffer, and cleared here when
+ * the reader caught up.
+ *
+ * returns 1 if the record must be dropped.
+ */
+static inline
+int lib_ring_buffer_prio_reject(const struct lib_ring_buffer_config *config,
+				struct lib_ring_buffer_ctx *ctx,
+				struct lib_ring_buffer *buf)
+{
+	unsigned long watermark;
+
+	if (config->mode != RING_BUFFER_DISCARD
+	    || likely(!ACCESS_ONCE(buf->prio_pressure))
+	    || (ctx->rflags & RING_BUFFER_RFLAG_HIGH_PRIO))
+		return 0;
+	watermark = ACCESS_ONCE(ctx->chan->prio_watermark);
+	if (!watermark
+	    || v_read(config, &buf->offset)
+	       - (unsigned long) atomic_long_read(&buf->consumed)
+	       < watermark) {
+		ACCESS_ONCE(buf->prio_pressure) = 0;
+		return 0;
+	}
+	v_inc(config, &buf->records_lost_prio);
+	return 1;
+}
+
 /**
  * lib_ring_buffer_reserve - Reserve space in a ring buffer.
  * @config: ring buffer instance configuration.
@@ -167,12 +201,26 @@ int lib_ring_buffer_reserve(const struct lib_ring_buffer_config *config,
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU)
 		buf = per_cpu_ptr(chan->backend.buf, ctx->cpu);
+	else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE)
+		buf = &chan->backend.buf[cpu_to_node(ctx->cpu)];
 	else
 		buf = chan->backend.buf;
-	if (unlikely(atomic_read(&buf->record_disabled)))
+	if (unlikely(atomic_read(&buf->record_disabled))) {
+		if (config->alloc == RING_BUFFER_ALLOC_PER_CPU
+		    && unlikely(chan->backend.lazy_alloc))
+			lib_ring_buffer_lazy_alloc_record_lost(config, chan,
+							       buf, ctx->cpu);
+		/* Pairs with the smp_wmb() in lib_ring_buffer_resize(). */
+		smp_rmb();
+		if (unlikely(ACCESS_ONCE(buf->resizing)))
+			v_inc(config, &buf->records_lost_resize);
 		return -EAGAIN;
+	}
 	ctx->buf = buf;
 
+	if (unlikely(lib_ring_buffer_prio_reject(config, ctx, buf)))
+		return -ENOBUFS;
+
 	/*
 	 * Perform retryable operations.
 	 */
@@ -201,7 +249,7 @@ int lib_ring_buffer_reserve(const struct lib_ring_buffer_config *config,
 	 * Clear noref flag for this subbuffer.
 	 */
 	lib_ring_buffer_clear_noref(config, &ctx->buf->backend,
-				subbuf_index(o_end - 1, chan));
+				subbuf_index(o_end - 1, buf));
 
 	ctx->pre_offset = o_begin;
 	ctx->buf_offset = o_begin + before_hdr_pad;
@@ -248,7 +296,7 @@ void lib_ring_buffer_commit(const struct lib_ring_buffer_config *config,
 	struct channel *chan = ctx->chan;
 	struct lib_ring_buffer *buf = ctx->buf;
 	unsigned long offset_end = ctx->buf_offset;
-	unsigned long endidx = subbuf_index(offset_end - 1, chan);
+	unsigned long endidx = subbuf_index(offset_end - 1, buf);
 	unsigned long commit_count;
 	struct commit_counters_hot *cc_hot = &buf->commit_hot[endidx];
 
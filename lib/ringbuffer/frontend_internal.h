@@ -35,26 +35,31 @@
 
 /* Buffer offset macros */
 
+/*
+ * The buffer size depends on the buffer: channel_resize() changes it one
+ * buffer at a time. The sub-buffer size is the same for the whole channel.
+ */
+
 /* buf_trunc mask selects only the buffer number. */
 static inline
-unsigned long buf_trunc(unsigned long offset, struct channel *chan)
+unsigned long buf_trunc(unsigned long offset, struct lib_ring_buffer *buf)
 {
-	return offset & ~(chan->backend.buf_size - 1);
+	return offset & ~(buf->backend.buf_size - 1);
 
 }
 
 /* Select the buffer number value (counter). */
 static inline
-unsigned long buf_trunc_val(unsigned long offset, struct channel *chan)
+unsigned long buf_trunc_val(unsigned long offset, struct lib_ring_buffer *buf)
 {
-	return buf_trunc(offset, chan) >> chan->backend.buf_size_order;
+	return buf_trunc(offset, buf) >> buf->backend.buf_size_order;
 }
 
 /* buf_offset mask selects only the offset within the current buffer. */
 static inline
-unsigned long buf_offset(unsigned long offset, struct channel *chan)
+unsigned long buf_offset(unsigned long offset, struct lib_ring_buffer *buf)
 {
-	return offset & (chan->backend.buf_size - 1);
+	return offset & (buf->backend.buf_size - 1);
 }
 
 /* subbuf_offset mask selects the offset within the current subbuffer. */
@@ -81,9 +86,10 @@ unsigned long subbuf_align(unsigned long offset, struct channel *chan)
 
 /* subbuf_index returns the index of the current subbuffer within the buffer. */
 static inline
-unsigned long subbuf_index(unsigned long offset, struct channel *chan)
+unsigned long subbuf_index(unsigned long offset, struct lib_ring_buffer *buf)
 {
-	return buf_offset(offset, chan) >> chan->backend.subbuf_size_order;
+	return buf_offset(offset, buf)
+		>> buf->backend.chan->backend.subbuf_size_order;
 }
 
 /*
@@ -180,6 +186,16 @@ void lib_ring_buffer_reserve_push_reader(struct lib_ring_buffer *buf,
 {
 	unsigned long consumed_old, consumed_new;
 
+	/*
+	 * The consumed count only moves forward, so a push boundary computed
+	 * from an older consumed count is never past the current one. Below
+	 * it, the reader cannot need to be pushed: leave its cache line alone.
+	 * Concurrent writers may store a stale boundary, which only makes the
+	 * next reservation take the full check.
+	 */
+	if (likely((long) (subbuf_trunc(offset, chan)
+			   - ACCESS_ONCE(buf->push_boundary)) < 0))
+		return;
 	do {
 		consumed_old = atomic_long_read(&buf->consumed);
 		/*
@@ -193,12 +209,17 @@ void lib_ring_buffer_reserve_push_reader(struct lib_ring_buffer *buf,
 		 */
 		if (unlikely(subbuf_trunc(offset, chan)
 			      - subbuf_trunc(consumed_old, chan)
-			     >= chan->backend.buf_size))
+			     >= buf->backend.buf_size))
 			consumed_new = subbuf_align(consumed_old, chan);
-		else
+		else {
+			ACCESS_ONCE(buf->push_boundary) =
+				subbuf_trunc(consumed_old, chan)
+				+ buf->backend.buf_size;
 			return;
+		}
 	} while (unlikely(atomic_long_cmpxchg(&buf->consumed, consumed_old,
 					      consumed_new) != consumed_old));
+	ACCESS_ONCE(buf->push_boundary) = consumed_new + buf->backend.buf_size;
 }
 
 static inline
@@ -242,12 +263,12 @@ int lib_ring_buffer_reserve_committed(const struct lib_ring_buffer_config *confi
 	 */
 	do {
 		offset = v_read(config, &buf->offset);
-		idx = subbuf_index(offset, chan);
+		idx = subbuf_index(offset, buf);
 		commit_count = v_read(config, &buf->commit_hot[idx].cc);
 	} while (offset != v_read(config, &buf->offset));
 
-	return ((buf_trunc(offset, chan) >> chan->backend.num_subbuf_order)
-		     - (commit_count & chan->commit_count_mask) == 0);
+	return ((buf_trunc(offset, buf) >> buf->backend.num_subbuf_order)
+		     - (commit_count & buf->commit_count_mask) == 0);
 }
 
 /*
@@ -270,8 +291,8 @@ void lib_ring_buffer_check_deliver(const struct lib_ring_buffer_config *config,
 					 - chan->backend.subbuf_size;
 
 	/* Check if all commits have been done */
-	if (unlikely((buf_trunc(offset, chan) >> chan->backend.num_subbuf_order)
-		     - (old_commit_count & chan->commit_count_mask) == 0))
+	if (unlikely((buf_trunc(offset, buf) >> buf->backend.num_subbuf_order)
+		     - (old_commit_count & buf->commit_count_mask) == 0))
 		lib_ring_buffer_check_deliver_slow(config, buf, chan, offset,
 			commit_count, idx, tsc);
 }
@@ -311,6 +332,27 @@ void lib_ring_buffer_write_commit_counter(const struct lib_ring_buffer_config *c
 		v_set(config, &cc_hot->seq, commit_count);
 }
 
+/*
+ * A record is dropped by a buffer of a lazily allocated channel, which stays
+ * disabled until it is created. Count it as lost, and request the creation of
+ * the buffer if it does not exist yet. The first request for a cpu queues an
+ * irq_work, which is safe from any tracing context, to wake up the worker.
+ */
+static inline
+void lib_ring_buffer_lazy_alloc_record_lost(const struct lib_ring_buffer_config *config,
+					    struct channel *chan,
+					    struct lib_ring_buffer *buf,
+					    int cpu)
+{
+	v_inc(config, &buf->records_lost_alloc);
+#ifdef CONFIG_IRQ_WORK
+	if (!buf->backend.allocated
+	    && !cpumask_test_cpu(cpu, chan->lazy_alloc_pending)
+	    && !cpumask_test_and_set_cpu(cpu, chan->lazy_alloc_pending))
+		irq_work_queue(&chan->lazy_alloc_irq_work);
+#endif
+}
+
 extern int lib_ring_buffer_create(struct lib_ring_buffer *buf,
 				  struct channel_backend *chanb, int cpu);
 extern void lib_ring_buffer_free(struct lib_ring_buffer *buf);
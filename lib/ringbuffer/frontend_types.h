@@ -29,6 +29,10 @@
  */
 
 #include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/irq_work.h>
+#include <linux/cache.h>
 #include <wrapper/ringbuffer/config.h>
 #include <wrapper/ringbuffer/backend_types.h>
 #include <wrapper/spinlock.h>
@@ -59,12 +63,6 @@ struct channel_iter {
 /* channel: collection of per-cpu ring buffers. */
 struct channel {
 	atomic_t record_disabled;
-	unsigned long commit_count_mask;	/*
-						 * Commit count mask, removing
-						 * the MSBs corresponding to
-						 * bits used to represent the
-						 * subbuffer index.
-						 */
 
 	struct channel_backend backend;		/* Associated backend */
 
@@ -81,9 +79,27 @@ struct channel {
 	unsigned int hp_iter_enable:1;		/* Enable hp iter notif. */
 #endif
 	struct notifier_block tick_nohz_notifier; /* CPU nohz notifier */
+	/* Lazy per-cpu buffer allocation, see channel_lazy_alloc_work() */
+	cpumask_var_t lazy_alloc_pending;	/* Buffers requested by writers */
+#ifdef CONFIG_IRQ_WORK
+	struct irq_work lazy_alloc_irq_work;	/* Kicks lazy_alloc_work */
+#endif
+	struct work_struct lazy_alloc_work;	/* Creates the buffers */
 	wait_queue_head_t read_wait;		/* reader wait queue */
 	wait_queue_head_t hp_wait;		/* CPU hotplug wait queue */
 	int finalized;				/* Has channel been finalized */
+	struct mutex resize_mutex;		/* Serializes channel_resize() */
+	u64 retention;				/*
+						 * Max age of overwrite mode
+						 * data, in clock units (0:
+						 * no limit)
+						 */
+	unsigned long prio_watermark;		/*
+						 * Discard mode: unconsumed
+						 * bytes above which only high
+						 * priority records are taken
+						 * (0: disabled)
+						 */
 	struct channel_iter iter;		/* Channel read-side iterator */
 	struct kref ref;			/* Reference count */
 };
@@ -117,51 +133,178 @@ struct lib_ring_buffer_iter {
 	unsigned int read_open:1;	/* Opened for reading ? */
 };
 
+/*
+ * Page shared with the consumer (RING_BUFFER_DISCARD only). The consumer
+ * publishes its consumed position there rather than issuing
+ * RING_BUFFER_PUT_NEXT_SUBBUF.
+ */
+struct lib_ring_buffer_consumer_page {
+	uint64_t consumed;		/* Written by the consumer */
+};
+
+/*
+ * Packet index entry, appended by the client when a packet is delivered,
+ * shared with the consumer. seq_num is written last, and is ~0ULL while the
+ * entry is being updated.
+ */
+struct lib_ring_buffer_packet_index {
+	uint64_t seq_num;		/* Packet sequence number */
+	uint64_t offset;		/* Packet position in the ring buffer */
+	uint64_t timestamp_begin;
+	uint64_t timestamp_end;
+	uint64_t content_size;		/* in bytes */
+	uint64_t packet_size;		/* in bytes, including padding */
+	uint64_t events_discarded;
+};
+
+/* Memory prepared for a buffer by channel_resize() */
+struct lib_ring_buffer_resize;
+
 /* ring buffer state */
+/*
+ * Saved state of a reader slot which is not the one selected. The selected
+ * slot lives in buf_rsb, get_subbuf_consumed and get_subbuf.
+ */
+struct lib_ring_buffer_reader_slot {
+	struct lib_ring_buffer_backend_subbuffer rsb;
+	unsigned long consumed;		/* Read-side consumed */
+	unsigned int held:1;		/* Sub-buffer being held by reader */
+};
+
 struct lib_ring_buffer {
-	/* First 32 bytes cache-hot cacheline */
+	/*
+	 * Writer-hot fields: updated or read by each reservation and commit.
+	 * The reader only writes full_hint, and only when it is set.
+	 */
 	union v_atomic offset;		/* Current offset in the buffer */
 	struct commit_counters_hot *commit_hot;
 					/* Commit count per sub-buffer */
-	atomic_long_t consumed;		/*
-					 * Current offset in the buffer
-					 * standard atomic access (shared)
-					 */
-	atomic_t record_disabled;
-	/* End of first 32 bytes cacheline */
+	unsigned long commit_count_mask;	/*
+						 * Commit count mask, removing
+						 * the MSBs corresponding to
+						 * bits used to represent the
+						 * subbuffer index.
+						 */
 	union v_atomic last_tsc;	/*
 					 * Last timestamp written in the buffer.
 					 */
-
-	struct lib_ring_buffer_backend backend;	/* Associated backend */
-
+	atomic_t record_disabled;
+	int prio_pressure;		/*
+					 * Unconsumed data reached the channel
+					 * priority watermark (hint)
+					 */
+	int full_hint;			/*
+					 * Discard mode: found full, nothing
+					 * consumed since
+					 */
+	unsigned long push_boundary;	/*
+					 * Write position from which the reader
+					 * may need to be pushed (never past
+					 * the actual one)
+					 */
 	struct commit_counters_cold *commit_cold;
 					/* Commit count per sub-buffer */
-	atomic_long_t active_readers;	/*
-					 * Active readers count
-					 * standard atomic access (shared)
-					 */
 					/* Dropped records */
 	union v_atomic records_lost_full;	/* Buffer full */
 	union v_atomic records_lost_wrap;	/* Nested wrap-around */
 	union v_atomic records_lost_big;	/* Events too big */
+	union v_atomic records_lost_prio;	/*
+						 * Normal priority records
+						 * refused above the priority
+						 * watermark
+						 */
+	union v_atomic records_lost_full_high;	/*
+						 * High priority records among
+						 * records_lost_full
+						 */
+	union v_atomic records_lost_alloc;	/*
+						 * Lazily allocated buffer not
+						 * created yet
+						 */
+	union v_atomic records_lost_resize;	/*
+						 * Buffer being resized by
+						 * channel_resize()
+						 */
 	union v_atomic records_count;	/* Number of records written */
 	union v_atomic records_overrun;	/* Number of overwritten records */
+
+	/*
+	 * Read-mostly for the writer. The fields updated by the reader are on
+	 * a cache line of their own within the backend.
+	 */
+	struct lib_ring_buffer_backend backend;	/* Associated backend */
+
+	/*
+	 * Reader-hot fields: updated by the consumer, on their own cache line
+	 * so reading positions does not bounce the writer lines. The writer
+	 * reads consumed when switching sub-buffer, and moves it forward in
+	 * overwrite mode.
+	 */
+	atomic_long_t consumed ____cacheline_aligned_in_smp;
+					/*
+					 * Current offset in the buffer
+					 * standard atomic access (shared)
+					 */
+	atomic_long_t active_readers;	/*
+					 * Active readers count
+					 * standard atomic access (shared)
+					 */
+	unsigned long get_subbuf_consumed;	/* Read-side consumed */
+	unsigned long prod_snapshot;	/* Producer count snapshot */
+	unsigned long cons_snapshot;	/* Consumer count snapshot */
+	struct lib_ring_buffer_reader_slot *reader_slots;
+					/* Per reader slot state */
+	unsigned int reader_slot;	/* Selected reader slot */
+	unsigned long reader_next;	/*
+					 * End of the last sub-buffer obtained
+					 * through a reader slot
+					 */
+	unsigned long live_offset;	/*
+					 * Bytes of the packet at the consumed
+					 * position already read by live reads
+					 */
+					/* Consumer position page, if enabled */
+	struct lib_ring_buffer_consumer_page *consumer_page;
+	atomic_long_t consumer_page_limit;	/*
+						 * Writers never move consumed
+						 * past it: start of the oldest
+						 * sub-buffer held, or end of
+						 * the last one released
+						 */
+	unsigned long packet_index_read;	/* Next entry to read */
+	unsigned int get_subbuf:1,	/* Sub-buffer being held by reader */
+		switch_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
+		read_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
+		quiescent:1,
+		splice_subbufs:1,	/* splice() moves whole sub-buffers */
+		live_header_stale:1;	/*
+					 * Packet header read by a live read
+					 * before the packet was complete
+					 */
 	wait_queue_head_t read_wait;	/* reader buffer-level wait queue */
+
+	/* Cold fields: sub-buffer switch, timers, setup and teardown. */
+					/* Packet index ring, if enabled */
+	struct lib_ring_buffer_packet_index *packet_index
+					____cacheline_aligned_in_smp;
+	unsigned long packet_index_len;	/* Number of entries (power of 2) */
+	atomic_long_t packet_index_head;	/*
+						 * Sequence number following
+						 * the newest entry
+						 */
 	wait_queue_head_t write_wait;	/* writer buffer-level wait queue (for metadata only) */
 	int finalized;			/* buffer has been finalized */
+	int resizing;			/* channel_resize() in progress */
+	struct lib_ring_buffer_resize *resize;	/*
+						 * Memory posted by
+						 * channel_resize(), taken
+						 * with xchg() to install it
+						 */
 	struct timer_list switch_timer;	/* timer for periodical switch */
 	struct timer_list read_timer;	/* timer for read poll */
 	raw_spinlock_t raw_tick_nohz_spinlock;	/* nohz entry lock/trylock */
 	struct lib_ring_buffer_iter iter;	/* read-side iterator */
-	unsigned long get_subbuf_consumed;	/* Read-side consumed */
-	unsigned long prod_snapshot;	/* Producer count snapshot */
-	unsigned long cons_snapshot;	/* Consumer count snapshot */
-	unsigned int get_subbuf:1,	/* Sub-buffer being held by reader */
-		switch_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
-		read_timer_enabled:1,	/* Protected by ring_buffer_nohz_lock */
-		quiescent:1;
-};
+} ____cacheline_aligned_in_smp;
 
 static inline
 void *channel_get_private(struct channel *chan)
@@ -170,6 +313,7 @@ void *channel_get_private(struct channel *chan)
 }
 
 void lib_ring_buffer_lost_event_too_big(struct channel *chan);
+void lib_ring_buffer_lost_event_full(struct channel *chan, unsigned int rflags);
 
 /*
  * Issue warnings and disable channels upon internal error.
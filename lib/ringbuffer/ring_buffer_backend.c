@@ -26,32 +26,160 @@
 #include <linux/errno.h>
 #include <linux/slab.h>
 #include <linux/cpu.h>
+#include <linux/workqueue.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
+#include <linux/pipe_fs_i.h>
 
 #include <wrapper/vmalloc.h>	/* for wrapper_vmalloc_sync_all() */
 #include <wrapper/ringbuffer/config.h>
 #include <wrapper/ringbuffer/backend.h>
 #include <wrapper/ringbuffer/frontend.h>
 
+static
+struct lib_ring_buffer_page_pool *
+lib_ring_buffer_page_pool_create(unsigned int max_pages, int node)
+{
+	struct lib_ring_buffer_page_pool *pool;
+
+	pool = kzalloc_node(sizeof(*pool) + max_pages * sizeof(struct page *),
+			    GFP_KERNEL | __GFP_NOWARN, node);
+	if (!pool)
+		return NULL;
+	spin_lock_init(&pool->lock);
+	kref_init(&pool->ref);
+	pool->node = node;
+	pool->max_pages = max_pages;
+	return pool;
+}
+
+static
+void lib_ring_buffer_page_pool_release(struct kref *kref)
+{
+	struct lib_ring_buffer_page_pool *pool =
+		container_of(kref, struct lib_ring_buffer_page_pool, ref);
+	unsigned int i;
+
+	for (i = 0; i < pool->nr_pages; i++)
+		__free_page(pool->pages[i]);
+	kfree(pool);
+}
+
+/**
+ * lib_ring_buffer_page_pool_alloc - get a replacement page for splice
+ * @pool: buffer page pool
+ *
+ * Takes a page from the pool, or allocates a zeroed page on the buffer
+ * NUMA node if the pool is empty. Recycled pages only ever contain data
+ * from this very buffer, so they do not need to be cleared. The caller
+ * must hand a reference to the pool (kref_get) along with each buffer
+ * page it moves into a pipe; it is dropped by
+ * lib_ring_buffer_page_pool_recycle().
+ */
+struct page *
+lib_ring_buffer_page_pool_alloc(struct lib_ring_buffer_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->nr_pages) {
+		page = pool->pages[--pool->nr_pages];
+		pool->hit++;
+	} else {
+		pool->miss++;
+	}
+	spin_unlock(&pool->lock);
+	if (page)
+		return page;
+	return alloc_pages_node(pool->node, GFP_KERNEL | __GFP_ZERO, 0);
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_page_pool_alloc);
+
+/**
+ * lib_ring_buffer_page_pool_recycle - give back a page released by a pipe
+ * @pool: buffer page pool
+ * @page: page released
+ *
+ * The page is only kept if we hold the last reference to it and it has
+ * not been stolen into the page cache. Drops the pool reference held by
+ * the page.
+ */
+void lib_ring_buffer_page_pool_recycle(struct lib_ring_buffer_page_pool *pool,
+				       struct page *page)
+{
+	if (page_count(page) == 1 && !page->mapping) {
+		spin_lock(&pool->lock);
+		if (pool->nr_pages < pool->max_pages) {
+			pool->pages[pool->nr_pages++] = page;
+			page = NULL;
+		}
+		spin_unlock(&pool->lock);
+	}
+	if (page)
+		__free_page(page);
+	kref_put(&pool->ref, lib_ring_buffer_page_pool_release);
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_page_pool_recycle);
+
+/*
+ * Allocate @nr_pages zeroed pages into @pages, in physically contiguous
+ * chunks of up to 2^@max_order pages. Each failure to allocate a chunk lowers
+ * the order for the rest of the buffer, down to order-0 pages, so a
+ * fragmented system does not pay for repeated attempts. Chunks are split, so
+ * the rest of the backend (write path, splice page exchange, mmap faults,
+ * free) keeps handling order-0 pages: only the physical placement changes. @nr_pages is a multiple of 2^@max_order, so chunks
+ * never cross a sub-buffer boundary.
+ */
+static
+int lib_ring_buffer_alloc_pages(struct page **pages, unsigned long nr_pages,
+				unsigned int max_order, int node)
+{
+	unsigned int order = max_order;
+	unsigned long i = 0, j;
+	struct page *page;
+
+	while (i < nr_pages) {
+		if (order)
+			page = alloc_pages_node(node, GFP_KERNEL | __GFP_NOWARN
+					| __GFP_NORETRY | __GFP_ZERO, order);
+		else
+			page = alloc_pages_node(node,
+					GFP_KERNEL | __GFP_NOWARN | __GFP_ZERO, 0);
+		if (unlikely(!page)) {
+			if (order) {
+				order--;
+				continue;
+			}
+			pages[i] = NULL;
+			return -ENOMEM;
+		}
+		if (order)
+			split_page(page, order);
+		for (j = 0; j < (1UL << order); j++)
+			pages[i++] = page + j;
+	}
+	return 0;
+}
+
 /**
  * lib_ring_buffer_backend_allocate - allocate a channel buffer
  * @config: ring buffer instance configuration
  * @buf: the buffer struct
  * @size: total size of the buffer
  * @num_subbuf: number of subbuffers
- * @extra_reader_sb: need extra subbuffer for reader
+ * @extra_reader_sb: number of extra subbuffers for reader
  */
 static
 int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config,
 				     struct lib_ring_buffer_backend *bufb,
 				     size_t size, size_t num_subbuf,
-				     int extra_reader_sb)
+				     unsigned int extra_reader_sb)
 {
 	struct channel_backend *chanb = &bufb->chan->backend;
 	unsigned long j, num_pages, num_pages_per_subbuf, page_idx = 0;
 	unsigned long subbuf_size, mmap_offset = 0;
 	unsigned long num_subbuf_alloc;
+	unsigned int max_order = 0;
 	struct page **pages;
 	unsigned long i;
 
@@ -60,14 +188,18 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	subbuf_size = chanb->subbuf_size;
 	num_subbuf_alloc = num_subbuf;
 
-	if (extra_reader_sb) {
-		num_pages += num_pages_per_subbuf; /* Add pages for reader */
-		num_subbuf_alloc++;
-	}
+	bufb->buf_size = size;
+	bufb->buf_size_order = get_count_order(size);
+	bufb->num_subbuf = num_subbuf;
+	bufb->num_subbuf_order = get_count_order(num_subbuf);
+
+	/* Add pages for reader */
+	num_pages += num_pages_per_subbuf * extra_reader_sb;
+	num_subbuf_alloc += extra_reader_sb;
 
 	pages = vmalloc_node(ALIGN(sizeof(*pages) * num_pages,
 				   1 << INTERNODE_CACHE_SHIFT),
-			cpu_to_node(max(bufb->cpu, 0)));
+			lib_ring_buffer_cpu_to_node(config, bufb->cpu));
 	if (unlikely(!pages))
 		goto pages_error;
 
@@ -75,14 +207,20 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 					 * num_subbuf_alloc,
 				  1 << INTERNODE_CACHE_SHIFT),
 			GFP_KERNEL | __GFP_NOWARN,
-			cpu_to_node(max(bufb->cpu, 0)));
+			lib_ring_buffer_cpu_to_node(config, bufb->cpu));
 	if (unlikely(!bufb->array))
 		goto array_error;
 
-	for (i = 0; i < num_pages; i++) {
-		pages[i] = alloc_pages_node(cpu_to_node(max(bufb->cpu, 0)),
-				GFP_KERNEL | __GFP_NOWARN | __GFP_ZERO, 0);
-		if (unlikely(!pages[i]))
+	if (config->backend == RING_BUFFER_STATIC) {
+		if (lib_ring_buffer_static_alloc_pages(pages, num_pages))
+			goto static_error;
+	} else {
+		if (config->page_order == RING_BUFFER_PAGE_HIGH_ORDER)
+			max_order = min_t(unsigned int,
+					  get_count_order(num_pages_per_subbuf),
+					  MAX_ORDER - 1);
+		if (lib_ring_buffer_alloc_pages(pages, num_pages, max_order,
+						lib_ring_buffer_cpu_to_node(config, bufb->cpu)))
 			goto depopulate;
 	}
 	bufb->num_pages_per_subbuf = num_pages_per_subbuf;
@@ -96,7 +234,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 				* num_pages_per_subbuf,
 				1 << INTERNODE_CACHE_SHIFT),
 				GFP_KERNEL | __GFP_NOWARN,
-				cpu_to_node(max(bufb->cpu, 0)));
+				lib_ring_buffer_cpu_to_node(config, bufb->cpu));
 		if (!bufb->array[i])
 			goto free_array;
 	}
@@ -107,7 +245,7 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 				* num_subbuf,
 				1 << INTERNODE_CACHE_SHIFT),
 				GFP_KERNEL | __GFP_NOWARN,
-				cpu_to_node(max(bufb->cpu, 0)));
+				lib_ring_buffer_cpu_to_node(config, bufb->cpu));
 	if (unlikely(!bufb->buf_wsb))
 		goto free_array;
 
@@ -115,11 +253,8 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 		bufb->buf_wsb[i].id = subbuffer_id(config, 0, 1, i);
 
 	/* Assign read-side subbuffer table */
-	if (extra_reader_sb)
-		bufb->buf_rsb.id = subbuffer_id(config, 0, 1,
-						num_subbuf_alloc - 1);
-	else
-		bufb->buf_rsb.id = subbuffer_id(config, 0, 1, 0);
+	bufb->buf_rsb.id = lib_ring_buffer_backend_reader_slot_id(config,
+							bufb, 0);
 
 	/* Allocate subbuffer packet counter table */
 	bufb->buf_cnt = kzalloc_node(ALIGN(
@@ -127,10 +262,23 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 				* num_subbuf,
 				1 << INTERNODE_CACHE_SHIFT),
 			GFP_KERNEL | __GFP_NOWARN,
-			cpu_to_node(max(bufb->cpu, 0)));
+			lib_ring_buffer_cpu_to_node(config, bufb->cpu));
 	if (unlikely(!bufb->buf_cnt))
 		goto free_wsb;
 
+	/*
+	 * Pages moved into a splice pipe are replaced from this pool. Size
+	 * it to hold the pages of two splice calls.
+	 */
+	if (config->output == RING_BUFFER_SPLICE) {
+		bufb->page_pool = lib_ring_buffer_page_pool_create(
+				2 * min_t(unsigned long, num_pages_per_subbuf,
+					  PIPE_DEF_BUFFERS),
+				lib_ring_buffer_cpu_to_node(config, bufb->cpu));
+		if (unlikely(!bufb->page_pool))
+			goto free_cnt;
+	}
+
 	/* Assign pages to page index */
 	for (i = 0; i < num_subbuf_alloc; i++) {
 		for (j = 0; j < num_pages_per_subbuf; j++) {
@@ -145,6 +293,17 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 		}
 	}
 
+	/* Map each sub-buffer contiguously, see lib_ring_buffer_write(). */
+	if (config->backend == RING_BUFFER_VMAP) {
+		for (i = 0; i < num_subbuf_alloc; i++) {
+			bufb->array[i]->virt =
+				vmap(&pages[i * num_pages_per_subbuf],
+				     num_pages_per_subbuf, VM_MAP, PAGE_KERNEL);
+			if (unlikely(!bufb->array[i]->virt))
+				goto unmap;
+		}
+	}
+
 	/*
 	 * If kmalloc ever uses vmalloc underneath, make sure the buffer pages
 	 * will not fault.
@@ -153,6 +312,14 @@ int lib_ring_buffer_backend_allocate(const struct lib_ring_buffer_config *config
 	vfree(pages);
 	return 0;
 
+unmap:
+	for (i = 0; (i < num_subbuf_alloc && bufb->array[i]->virt); i++)
+		vunmap(bufb->array[i]->virt);
+	if (bufb->page_pool)
+		kref_put(&bufb->page_pool->ref,
+			 lib_ring_buffer_page_pool_release);
+free_cnt:
+	kfree(bufb->buf_cnt);
 free_wsb:
 	kfree(bufb->buf_wsb);
 free_array:
@@ -160,8 +327,13 @@ free_array:
 		kfree(bufb->array[i]);
 depopulate:
 	/* Free all allocated pages */
-	for (i = 0; (i < num_pages && pages[i]); i++)
-		__free_page(pages[i]);
+	for (i = 0; (i < num_pages && pages[i]); i++) {
+		if (config->backend == RING_BUFFER_STATIC)
+			lib_ring_buffer_static_free_page(pages[i]);
+		else
+			__free_page(pages[i]);
+	}
+static_error:
 	kfree(bufb->array);
 array_error:
 	vfree(pages);
@@ -182,26 +354,131 @@ int lib_ring_buffer_backend_create(struct lib_ring_buffer_backend *bufb,
 						chanb->extra_reader_sb);
 }
 
-void lib_ring_buffer_backend_free(struct lib_ring_buffer_backend *bufb)
+static
+void _lib_ring_buffer_backend_free(struct lib_ring_buffer_backend *bufb)
 {
 	struct channel_backend *chanb = &bufb->chan->backend;
-	unsigned long i, j, num_subbuf_alloc;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	unsigned long num_subbuf_alloc, i, j;
 
-	num_subbuf_alloc = chanb->num_subbuf;
-	if (chanb->extra_reader_sb)
-		num_subbuf_alloc++;
+	num_subbuf_alloc = bufb->num_subbuf + chanb->extra_reader_sb;
 
 	kfree(bufb->buf_wsb);
 	kfree(bufb->buf_cnt);
+	if (bufb->page_pool) {
+		/* Pages still in flight keep the pool alive. */
+		kref_put(&bufb->page_pool->ref,
+			 lib_ring_buffer_page_pool_release);
+		bufb->page_pool = NULL;
+	}
 	for (i = 0; i < num_subbuf_alloc; i++) {
-		for (j = 0; j < bufb->num_pages_per_subbuf; j++)
-			__free_page(pfn_to_page(bufb->array[i]->p[j].pfn));
+		if (bufb->array[i]->virt)
+			vunmap(bufb->array[i]->virt);
+		for (j = 0; j < bufb->num_pages_per_subbuf; j++) {
+			struct page *page = pfn_to_page(bufb->array[i]->p[j].pfn);
+
+			if (config->backend == RING_BUFFER_STATIC)
+				lib_ring_buffer_static_free_page(page);
+			else
+				__free_page(page);
+		}
 		kfree(bufb->array[i]);
 	}
 	kfree(bufb->array);
+}
+
+void lib_ring_buffer_backend_free(struct lib_ring_buffer_backend *bufb)
+{
+	_lib_ring_buffer_backend_free(bufb);
 	bufb->allocated = 0;
 }
 
+/**
+ * lib_ring_buffer_backend_resize_alloc - allocate a buffer backend for resize
+ * @new_bufb: zeroed backend receiving the new memory
+ * @bufb: backend of the buffer being resized
+ * @num_subbuf: new number of sub-buffers
+ *
+ * Allocates the memory of @bufb for @num_subbuf sub-buffers of the current
+ * sub-buffer size, without touching @bufb, which may still be written to.
+ * The result is either installed with lib_ring_buffer_backend_resize_install()
+ * or released with lib_ring_buffer_backend_resize_free().
+ */
+int lib_ring_buffer_backend_resize_alloc(struct lib_ring_buffer_backend *new_bufb,
+					 struct lib_ring_buffer_backend *bufb,
+					 size_t num_subbuf)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+
+	new_bufb->chan = bufb->chan;
+	new_bufb->cpu = bufb->cpu;
+	return lib_ring_buffer_backend_allocate(&chanb->config, new_bufb,
+						num_subbuf * chanb->subbuf_size,
+						num_subbuf, chanb->extra_reader_sb);
+}
+
+/**
+ * lib_ring_buffer_backend_resize_free - free an unused resize allocation
+ * @new_bufb: backend filled by lib_ring_buffer_backend_resize_alloc()
+ */
+void lib_ring_buffer_backend_resize_free(struct lib_ring_buffer_backend *new_bufb)
+{
+	_lib_ring_buffer_backend_free(new_bufb);
+}
+
+/**
+ * lib_ring_buffer_backend_resize_install - switch a buffer to its new memory
+ * @bufb: backend of the buffer being resized
+ * @new_bufb: backend filled by lib_ring_buffer_backend_resize_alloc()
+ * @begin: position of the first sub-buffer to keep
+ * @end: position following the last sub-buffer to keep
+ *
+ * Hands the sub-buffers from @begin to @end over to the new memory: each one
+ * swaps its pages with the ones found at its index in the new geometry, as
+ * the reader does with the writer sub-buffers. The memory left in @bufb is
+ * then freed, and @bufb takes the memory and geometry of @new_bufb. At most
+ * the new number of sub-buffers can be kept. Must be called with no writer on
+ * the buffer and no sub-buffer held by the reader.
+ */
+void lib_ring_buffer_backend_resize_install(struct lib_ring_buffer_backend *bufb,
+					    struct lib_ring_buffer_backend *new_bufb,
+					    unsigned long begin,
+					    unsigned long end)
+{
+	struct channel_backend *chanb = &bufb->chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	struct lib_ring_buffer_backend_pages *pages;
+	unsigned long pos, idx, new_idx, sb_bindex, new_sb_bindex;
+
+	CHAN_WARN_ON(chanb, end - begin > new_bufb->buf_size);
+	for (pos = begin; pos != end; pos += chanb->subbuf_size) {
+		idx = (pos & (bufb->buf_size - 1)) >> chanb->subbuf_size_order;
+		new_idx = (pos & (new_bufb->buf_size - 1))
+			  >> chanb->subbuf_size_order;
+		sb_bindex = subbuffer_id_get_index(config,
+						   bufb->buf_wsb[idx].id);
+		new_sb_bindex = subbuffer_id_get_index(config,
+					new_bufb->buf_wsb[new_idx].id);
+		pages = new_bufb->array[new_sb_bindex];
+		new_bufb->array[new_sb_bindex] = bufb->array[sb_bindex];
+		bufb->array[sb_bindex] = pages;
+		new_bufb->buf_cnt[new_idx].timestamp_end =
+			bufb->buf_cnt[idx].timestamp_end;
+	}
+
+	_lib_ring_buffer_backend_free(bufb);
+	bufb->buf_size = new_bufb->buf_size;
+	bufb->buf_size_order = new_bufb->buf_size_order;
+	bufb->num_subbuf = new_bufb->num_subbuf;
+	bufb->num_subbuf_order = new_bufb->num_subbuf_order;
+	bufb->buf_wsb = new_bufb->buf_wsb;
+	bufb->buf_rsb = new_bufb->buf_rsb;
+	bufb->buf_cnt = new_bufb->buf_cnt;
+	bufb->array = new_bufb->array;
+	bufb->num_pages_per_subbuf = new_bufb->num_pages_per_subbuf;
+	bufb->page_pool = new_bufb->page_pool;
+}
+
 void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb)
 {
 	struct channel_backend *chanb = &bufb->chan->backend;
@@ -209,17 +486,12 @@ void lib_ring_buffer_backend_reset(struct lib_ring_buffer_backend *bufb)
 	unsigned long num_subbuf_alloc;
 	unsigned int i;
 
-	num_subbuf_alloc = chanb->num_subbuf;
-	if (chanb->extra_reader_sb)
-		num_subbuf_alloc++;
+	num_subbuf_alloc = bufb->num_subbuf + chanb->extra_reader_sb;
 
-	for (i = 0; i < chanb->num_subbuf; i++)
+	for (i = 0; i < bufb->num_subbuf; i++)
 		bufb->buf_wsb[i].id = subbuffer_id(config, 0, 1, i);
-	if (chanb->extra_reader_sb)
-		bufb->buf_rsb.id = subbuffer_id(config, 0, 1,
-						num_subbuf_alloc - 1);
-	else
-		bufb->buf_rsb.id = subbuffer_id(config, 0, 1, 0);
+	bufb->buf_rsb.id = lib_ring_buffer_backend_reader_slot_id(config,
+							bufb, 0);
 
 	for (i = 0; i < num_subbuf_alloc; i++) {
 		/* Don't reset mmap_offset */
@@ -249,6 +521,64 @@ void channel_backend_reset(struct channel_backend *chanb)
 	chanb->start_tsc = config->cb.ring_buffer_clock_read(chan);
 }
 
+/*
+ * Create the buffer of @cpu when the cpu is brought up, unless buffers are
+ * allocated lazily, on their first record.
+ */
+static
+int channel_backend_create_cpu_buffer(struct channel_backend *chanb, int cpu)
+{
+	if (chanb->lazy_alloc)
+		return 0;
+	return lib_ring_buffer_create(per_cpu_ptr(chanb->buf, cpu), chanb, cpu);
+}
+
+struct channel_backend_create_work {
+	struct work_struct work;
+	struct channel_backend *chanb;
+	int cpu;
+};
+
+static
+void channel_backend_create_work_fn(struct work_struct *work)
+{
+	struct channel_backend_create_work *cw = container_of(work,
+			struct channel_backend_create_work, work);
+
+	(void) channel_backend_create_cpu_buffer(cw->chanb, cw->cpu);
+}
+
+/*
+ * Create the buffers of the online cpus in parallel, each from a worker
+ * running on the buffer cpu, so its pages are allocated and cleared by a cpu
+ * local to them. The caller waits for all of them. Buffers this fails to
+ * create are left to the caller per-cpu creation, which tries again and
+ * reports the error.
+ *
+ * Called with cpu hotplug held, or without cpu hotplug support.
+ */
+static
+void channel_backend_create_online_buffers(struct channel_backend *chanb)
+{
+	struct channel_backend_create_work *works;
+	int cpu;
+
+	if (chanb->lazy_alloc)
+		return;
+	works = kcalloc(nr_cpu_ids, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		return;
+	for_each_online_cpu(cpu) {
+		INIT_WORK(&works[cpu].work, channel_backend_create_work_fn);
+		works[cpu].chanb = chanb;
+		works[cpu].cpu = cpu;
+		queue_work_on(cpu, system_wq, &works[cpu].work);
+	}
+	for_each_online_cpu(cpu)
+		flush_work(&works[cpu].work);
+	kfree(works);
+}
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0))
 
 /*
@@ -264,13 +594,11 @@ int lttng_cpuhp_rb_backend_prepare(unsigned int cpu,
 	struct channel_backend *chanb = container_of(node,
 			struct channel_backend, cpuhp_prepare);
 	const struct lib_ring_buffer_config *config = &chanb->config;
-	struct lib_ring_buffer *buf;
 	int ret;
 
 	CHAN_WARN_ON(chanb, config->alloc == RING_BUFFER_ALLOC_GLOBAL);
 
-	buf = per_cpu_ptr(chanb->buf, cpu);
-	ret = lib_ring_buffer_create(buf, chanb, cpu);
+	ret = channel_backend_create_cpu_buffer(chanb, cpu);
 	if (ret) {
 		printk(KERN_ERR
 		  "ring_buffer_cpu_hp_callback: cpu %d "
@@ -302,7 +630,6 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 	struct channel_backend *chanb = container_of(nb, struct channel_backend,
 						     cpu_hp_notifier);
 	const struct lib_ring_buffer_config *config = &chanb->config;
-	struct lib_ring_buffer *buf;
 	int ret;
 
 	CHAN_WARN_ON(chanb, config->alloc == RING_BUFFER_ALLOC_GLOBAL);
@@ -310,8 +637,7 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 	switch (action) {
 	case CPU_UP_PREPARE:
 	case CPU_UP_PREPARE_FROZEN:
-		buf = per_cpu_ptr(chanb->buf, cpu);
-		ret = lib_ring_buffer_create(buf, chanb, cpu);
+		ret = channel_backend_create_cpu_buffer(chanb, cpu);
 		if (ret) {
 			printk(KERN_ERR
 			  "ring_buffer_cpu_hp_callback: cpu %d "
@@ -342,6 +668,9 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
  * @parent: dentry of parent directory, %NULL for root directory
  * @subbuf_size: size of sub-buffers (> PAGE_SIZE, power of 2)
  * @num_subbuf: number of sub-buffers (power of 2)
+ * @num_reader_subbuf: number of sub-buffers the reader can hold at once
+ *                     (0 is the same as 1)
+ * @lazy_alloc: allocate per-cpu buffers on their first record
  *
  * Returns channel pointer if successful, %NULL otherwise.
  *
@@ -354,7 +683,8 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 int channel_backend_init(struct channel_backend *chanb,
 			 const char *name,
 			 const struct lib_ring_buffer_config *config,
-			 void *priv, size_t subbuf_size, size_t num_subbuf)
+			 void *priv, size_t subbuf_size, size_t num_subbuf,
+			 unsigned int num_reader_subbuf, int lazy_alloc)
 {
 	struct channel *chan = container_of(chanb, struct channel, backend);
 	unsigned int i;
@@ -382,23 +712,54 @@ int channel_backend_init(struct channel_backend *chanb,
 	if (config->mode == RING_BUFFER_OVERWRITE && num_subbuf < 2)
 		return -EINVAL;
 
-	ret = subbuffer_id_check_index(config, num_subbuf);
+	if (!num_reader_subbuf)
+		num_reader_subbuf = 1;
+	/*
+	 * The reader cannot hold more sub-buffers than the writer has,
+	 * and in overwrite mode each of them needs its own spare
+	 * sub-buffer to exchange with the writer.
+	 */
+	if (num_reader_subbuf > num_subbuf)
+		return -EINVAL;
+
+	ret = subbuffer_id_check_index(config, num_subbuf + num_reader_subbuf);
 	if (ret)
 		return ret;
 
+	/*
+	 * Splice moves sub-buffer pages into the pipe, which would leave a
+	 * stale contiguous mapping behind.
+	 */
+	if (config->backend == RING_BUFFER_VMAP
+	    && config->output == RING_BUFFER_SPLICE)
+		return -EINVAL;
+
+	/* The per-cpu iterators expect all buffers of online cpus. */
+	if (lazy_alloc && config->output == RING_BUFFER_ITERATOR)
+		return -EINVAL;
+
+	/* Per-node buffers are tracked by node in the channel cpumask. */
+	if (config->alloc == RING_BUFFER_ALLOC_PER_NODE
+	    && (nr_node_ids > nr_cpu_ids
+		|| config->output == RING_BUFFER_ITERATOR))
+		return -EINVAL;
+
 	chanb->priv = priv;
 	chanb->buf_size = num_subbuf * subbuf_size;
 	chanb->subbuf_size = subbuf_size;
 	chanb->buf_size_order = get_count_order(chanb->buf_size);
 	chanb->subbuf_size_order = get_count_order(subbuf_size);
 	chanb->num_subbuf_order = get_count_order(num_subbuf);
+	chanb->num_reader_sb = num_reader_subbuf;
 	chanb->extra_reader_sb =
-			(config->mode == RING_BUFFER_OVERWRITE) ? 1 : 0;
+		(config->mode == RING_BUFFER_OVERWRITE) ? num_reader_subbuf : 0;
 	chanb->num_subbuf = num_subbuf;
+	chanb->lazy_alloc = lazy_alloc
+		&& config->alloc == RING_BUFFER_ALLOC_PER_CPU;
 	strlcpy(chanb->name, name, NAME_MAX);
 	memcpy(&chanb->config, config, sizeof(chanb->config));
 
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL) {
 		if (!zalloc_cpumask_var(&chanb->cpumask, GFP_KERNEL))
 			return -ENOMEM;
 	}
@@ -408,8 +769,22 @@ int channel_backend_init(struct channel_backend *chanb,
 		chanb->buf = alloc_percpu(struct lib_ring_buffer);
 		if (!chanb->buf)
 			goto free_cpumask;
+		/*
+		 * Buffers allocated lazily stay disabled until they are
+		 * created: records dropped meanwhile are counted, and request
+		 * the allocation. See lib_ring_buffer_reserve().
+		 */
+		if (chanb->lazy_alloc) {
+			for_each_possible_cpu(i)
+				atomic_set(&per_cpu_ptr(chanb->buf, i)->record_disabled,
+					   1);
+		}
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0))
+		get_online_cpus();
+		channel_backend_create_online_buffers(chanb);
+		put_online_cpus();
+
 		chanb->cpuhp_prepare.component = LTTNG_RING_BUFFER_BACKEND;
 		ret = cpuhp_state_add_instance(lttng_rb_hp_prepare,
 			&chanb->cpuhp_prepare.node);
@@ -436,23 +811,46 @@ int channel_backend_init(struct channel_backend *chanb,
 			register_hotcpu_notifier(&chanb->cpu_hp_notifier);
 
 			get_online_cpus();
+			channel_backend_create_online_buffers(chanb);
 			for_each_online_cpu(i) {
-				ret = lib_ring_buffer_create(per_cpu_ptr(chanb->buf, i),
-							 chanb, i);
+				ret = channel_backend_create_cpu_buffer(chanb, i);
 				if (ret)
 					goto free_bufs;	/* cpu hotplug locked */
 			}
 			put_online_cpus();
 #else
+			channel_backend_create_online_buffers(chanb);
 			for_each_possible_cpu(i) {
-				ret = lib_ring_buffer_create(per_cpu_ptr(chanb->buf, i),
-							 chanb, i);
+				ret = channel_backend_create_cpu_buffer(chanb, i);
 				if (ret)
 					goto free_bufs;
 			}
 #endif
 		}
 #endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)) */
+	} else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE) {
+		chanb->buf = kcalloc(nr_node_ids, sizeof(struct lib_ring_buffer),
+				     GFP_KERNEL);
+		if (!chanb->buf)
+			goto free_cpumask;
+		for_each_possible_cpu(i) {
+			int node = cpu_to_node(i);
+
+			if (node == NUMA_NO_NODE)
+				continue;
+			ret = lib_ring_buffer_create(&chanb->buf[node], chanb,
+						     node);
+			if (ret)
+				goto free_bufs;
+		}
+		/*
+		 * Records of cpus moved to a node without buffer afterwards are
+		 * dropped.
+		 */
+		for_each_node(i) {
+			if (!chanb->buf[i].backend.allocated)
+				atomic_set(&chanb->buf[i].record_disabled, 1);
+		}
 	} else {
 		chanb->buf = kzalloc(sizeof(struct lib_ring_buffer), GFP_KERNEL);
 		if (!chanb->buf)
@@ -486,10 +884,19 @@ free_bufs:
 			lib_ring_buffer_free(buf);
 		}
 		free_percpu(chanb->buf);
+	} else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE) {
+		for_each_node(i) {
+			struct lib_ring_buffer *buf = &chanb->buf[i];
+
+			if (!buf->backend.allocated)
+				continue;
+			lib_ring_buffer_free(buf);
+		}
+		kfree(chanb->buf);
 	} else
 		kfree(chanb->buf);
 free_cpumask:
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU)
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL)
 		free_cpumask_var(chanb->cpumask);
 	return -ENOMEM;
 }
@@ -538,6 +945,16 @@ void channel_backend_free(struct channel_backend *chanb)
 		}
 		free_cpumask_var(chanb->cpumask);
 		free_percpu(chanb->buf);
+	} else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE) {
+		for_each_node(i) {
+			struct lib_ring_buffer *buf = &chanb->buf[i];
+
+			if (!buf->backend.allocated)
+				continue;
+			lib_ring_buffer_free(buf);
+		}
+		free_cpumask_var(chanb->cpumask);
+		kfree(chanb->buf);
 	} else {
 		struct lib_ring_buffer *buf = chanb->buf;
 
@@ -575,7 +992,7 @@ void _lib_ring_buffer_write(struct lib_ring_buffer_backend *bufb, size_t offset,
 		 * Underlying layer should never ask for writes across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 
 		pagecpy = min_t(size_t, len, PAGE_SIZE - (offset & ~PAGE_MASK));
 		id = bufb->buf_wsb[sbidx].id;
@@ -620,7 +1037,7 @@ void _lib_ring_buffer_memset(struct lib_ring_buffer_backend *bufb,
 		 * Underlying layer should never ask for writes across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 
 		pagecpy = min_t(size_t, len, PAGE_SIZE - (offset & ~PAGE_MASK));
 		id = bufb->buf_wsb[sbidx].id;
@@ -668,7 +1085,7 @@ void _lib_ring_buffer_strcpy(struct lib_ring_buffer_backend *bufb,
 		 * Underlying layer should never ask for writes across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 
 		pagecpy = min_t(size_t, len, PAGE_SIZE - (offset & ~PAGE_MASK));
 		id = bufb->buf_wsb[sbidx].id;
@@ -752,7 +1169,7 @@ void _lib_ring_buffer_copy_from_user_inatomic(struct lib_ring_buffer_backend *bu
 		 * Underlying layer should never ask for writes across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 
 		pagecpy = min_t(size_t, len, PAGE_SIZE - (offset & ~PAGE_MASK));
 		id = bufb->buf_wsb[sbidx].id;
@@ -808,7 +1225,7 @@ void _lib_ring_buffer_strcpy_from_user_inatomic(struct lib_ring_buffer_backend *
 		 * Underlying layer should never ask for writes across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 
 		pagecpy = min_t(size_t, len, PAGE_SIZE - (offset & ~PAGE_MASK));
 		id = bufb->buf_wsb[sbidx].id;
@@ -877,7 +1294,7 @@ size_t lib_ring_buffer_read(struct lib_ring_buffer_backend *bufb, size_t offset,
 	unsigned long sb_bindex, id;
 
 	orig_len = len;
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	if (unlikely(!len))
 		return 0;
@@ -900,7 +1317,7 @@ size_t lib_ring_buffer_read(struct lib_ring_buffer_backend *bufb, size_t offset,
 		 * Underlying layer should never ask for reads across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 	}
 	return orig_len;
 }
@@ -928,7 +1345,7 @@ int __lib_ring_buffer_copy_to_user(struct lib_ring_buffer_backend *bufb,
 	struct lib_ring_buffer_backend_pages *rpages;
 	unsigned long sb_bindex, id;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	if (unlikely(!len))
 		return 0;
@@ -953,7 +1370,7 @@ int __lib_ring_buffer_copy_to_user(struct lib_ring_buffer_backend *bufb,
 		 * Underlying layer should never ask for reads across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 	}
 	return 0;
 }
@@ -981,7 +1398,7 @@ int lib_ring_buffer_read_cstr(struct lib_ring_buffer_backend *bufb, size_t offse
 	struct lib_ring_buffer_backend_pages *rpages;
 	unsigned long sb_bindex, id;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	orig_offset = offset;
 	if (unlikely(!len))
@@ -1011,7 +1428,7 @@ int lib_ring_buffer_read_cstr(struct lib_ring_buffer_backend *bufb, size_t offse
 		 * Underlying layer should never ask for reads across
 		 * subbuffers.
 		 */
-		CHAN_WARN_ON(chanb, offset >= chanb->buf_size);
+		CHAN_WARN_ON(chanb, offset >= bufb->buf_size);
 	}
 	if (dest && len)
 		((char *)dest)[0] = 0;
@@ -1037,7 +1454,7 @@ unsigned long *lib_ring_buffer_read_get_pfn(struct lib_ring_buffer_backend *bufb
 	const struct lib_ring_buffer_config *config = &chanb->config;
 	unsigned long sb_bindex, id;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	id = bufb->buf_rsb.id;
 	sb_bindex = subbuffer_id_get_index(config, id);
@@ -1069,7 +1486,7 @@ void *lib_ring_buffer_read_offset_address(struct lib_ring_buffer_backend *bufb,
 	const struct lib_ring_buffer_config *config = &chanb->config;
 	unsigned long sb_bindex, id;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	id = bufb->buf_rsb.id;
 	sb_bindex = subbuffer_id_get_index(config, id);
@@ -1099,7 +1516,7 @@ void *lib_ring_buffer_offset_address(struct lib_ring_buffer_backend *bufb,
 	const struct lib_ring_buffer_config *config = &chanb->config;
 	unsigned long sb_bindex, id;
 
-	offset &= chanb->buf_size - 1;
+	offset &= bufb->buf_size - 1;
 	sbidx = offset >> chanb->subbuf_size_order;
 	index = (offset & (chanb->subbuf_size - 1)) >> PAGE_SHIFT;
 	id = bufb->buf_wsb[sbidx].id;
@@ -1110,3 +1527,13 @@ void *lib_ring_buffer_offset_address(struct lib_ring_buffer_backend *bufb,
 	return rpages->p[index].virt + (offset & ~PAGE_MASK);
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_offset_address);
+
+int lib_ring_buffer_backend_init(void)
+{
+	return lib_ring_buffer_static_init();
+}
+
+void lib_ring_buffer_backend_exit(void)
+{
+	lib_ring_buffer_static_exit();
+}
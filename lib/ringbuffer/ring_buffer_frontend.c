@@ -51,9 +51,13 @@
  *   - put_subbuf
  */
 
+#include <linux/completion.h>
 #include <linux/delay.h>
 #include <linux/module.h>
 #include <linux/percpu.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 
 #include <wrapper/ringbuffer/config.h>
 #include <wrapper/ringbuffer/backend.h>
@@ -96,6 +100,8 @@ void lib_ring_buffer_print_errors(struct channel *chan,
 static
 void _lib_ring_buffer_switch_remote(struct lib_ring_buffer *buf,
 		enum switch_mode mode);
+static
+void lib_ring_buffer_retention_reclaim(struct lib_ring_buffer *buf);
 
 static
 int lib_ring_buffer_poll_deliver(const struct lib_ring_buffer_config *config,
@@ -105,7 +111,7 @@ int lib_ring_buffer_poll_deliver(const struct lib_ring_buffer_config *config,
 	unsigned long consumed_old, consumed_idx, commit_count, write_offset;
 
 	consumed_old = atomic_long_read(&buf->consumed);
-	consumed_idx = subbuf_index(consumed_old, chan);
+	consumed_idx = subbuf_index(consumed_old, buf);
 	commit_count = v_read(config, &buf->commit_cold[consumed_idx].cc_sb);
 	/*
 	 * No memory barrier here, since we are only interested
@@ -121,9 +127,9 @@ int lib_ring_buffer_poll_deliver(const struct lib_ring_buffer_config *config,
 	 */
 
 	if (((commit_count - chan->backend.subbuf_size)
-	     & chan->commit_count_mask)
-	    - (buf_trunc(consumed_old, chan)
-	       >> chan->backend.num_subbuf_order)
+	     & buf->commit_count_mask)
+	    - (buf_trunc(consumed_old, buf)
+	       >> buf->backend.num_subbuf_order)
 	    != 0)
 		return 0;
 
@@ -138,6 +144,45 @@ int lib_ring_buffer_poll_deliver(const struct lib_ring_buffer_config *config,
 	return 1;
 }
 
+/*
+ * Invalidate all entries of the packet index ring @packet_index, the next
+ * entry expected by the reader being @seq_num.
+ */
+static
+void lib_ring_buffer_packet_index_init(struct lib_ring_buffer *buf,
+		struct lib_ring_buffer_packet_index *packet_index,
+		unsigned long seq_num)
+{
+	unsigned long i;
+
+	for (i = 0; i < buf->packet_index_len; i++)
+		packet_index[i].seq_num = ~0ULL;
+	atomic_long_set(&buf->packet_index_head, seq_num);
+	buf->packet_index_read = seq_num;
+}
+
+/*
+ * Put back the reader slots in their initial state, slot 0 being selected.
+ * The backend resets the selected slot sub-buffer id.
+ */
+static
+void lib_ring_buffer_reader_slots_reset(struct lib_ring_buffer *buf)
+{
+	struct channel_backend *chanb = &buf->backend.chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	unsigned int i;
+
+	for (i = 0; i < chanb->num_reader_sb; i++) {
+		buf->reader_slots[i].rsb.id =
+			lib_ring_buffer_backend_reader_slot_id(config,
+							       &buf->backend, i);
+		buf->reader_slots[i].consumed = 0;
+		buf->reader_slots[i].held = 0;
+	}
+	buf->reader_slot = 0;
+	buf->reader_next = 0;
+}
+
 /*
  * Must be called under cpu hotplug protection.
  */
@@ -148,6 +193,10 @@ void lib_ring_buffer_free(struct lib_ring_buffer *buf)
 	lib_ring_buffer_print_errors(chan, buf, buf->backend.cpu);
 	kfree(buf->commit_hot);
 	kfree(buf->commit_cold);
+	kfree(buf->reader_slots);
+	if (buf->consumer_page)
+		free_page((unsigned long) buf->consumer_page);
+	vfree(buf->packet_index);
 
 	lib_ring_buffer_backend_free(&buf->backend);
 }
@@ -173,19 +222,36 @@ void lib_ring_buffer_reset(struct lib_ring_buffer *buf)
 	 */
 	lib_ring_buffer_iterator_reset(buf);
 	v_set(config, &buf->offset, 0);
-	for (i = 0; i < chan->backend.num_subbuf; i++) {
+	for (i = 0; i < buf->backend.num_subbuf; i++) {
 		v_set(config, &buf->commit_hot[i].cc, 0);
 		v_set(config, &buf->commit_hot[i].seq, 0);
 		v_set(config, &buf->commit_cold[i].cc_sb, 0);
 	}
+	/* Don't reset commit_count_mask, still valid */
 	atomic_long_set(&buf->consumed, 0);
+	if (buf->consumer_page) {
+		buf->consumer_page->consumed = 0;
+		atomic_long_set(&buf->consumer_page_limit, 0);
+	}
+	if (buf->packet_index)
+		lib_ring_buffer_packet_index_init(buf, buf->packet_index, 0);
 	atomic_set(&buf->record_disabled, 0);
 	v_set(config, &buf->last_tsc, 0);
 	lib_ring_buffer_backend_reset(&buf->backend);
+	lib_ring_buffer_reader_slots_reset(buf);
+	buf->live_offset = 0;
+	buf->live_header_stale = 0;
 	/* Don't reset number of active readers */
 	v_set(config, &buf->records_lost_full, 0);
 	v_set(config, &buf->records_lost_wrap, 0);
 	v_set(config, &buf->records_lost_big, 0);
+	v_set(config, &buf->records_lost_prio, 0);
+	v_set(config, &buf->records_lost_full_high, 0);
+	v_set(config, &buf->records_lost_alloc, 0);
+	v_set(config, &buf->records_lost_resize, 0);
+	buf->prio_pressure = 0;
+	buf->full_hint = 0;
+	buf->push_boundary = 0;
 	v_set(config, &buf->records_count, 0);
 	v_set(config, &buf->records_overrun, 0);
 	buf->finalized = 0;
@@ -208,7 +274,6 @@ void channel_reset(struct channel *chan)
 	 */
 	channel_iterator_reset(chan);
 	atomic_set(&chan->record_disabled, 0);
-	/* Don't reset commit_count_mask, still valid */
 	channel_backend_reset(&chan->backend);
 	/* Don't reset switch/read timer interval */
 	/* Don't reset notifiers and notifier enable bits */
@@ -235,20 +300,24 @@ int lib_ring_buffer_create(struct lib_ring_buffer *buf,
 
 	/*
 	 * Paranoia: per cpu dynamic allocation is not officially documented as
-	 * zeroing the memory, so let's do it here too, just in case.
+	 * zeroing the memory, so let's do it here too, just in case. Lazily
+	 * allocated buffers are created while writers may see them: keep them
+	 * disabled, and keep the count of records they dropped.
 	 */
-	memset(buf, 0, sizeof(*buf));
+	if (!chanb->lazy_alloc)
+		memset(buf, 0, sizeof(*buf));
 
 	ret = lib_ring_buffer_backend_create(&buf->backend, &chan->backend, cpu);
 	if (ret)
 		return ret;
+	buf->commit_count_mask = (~0UL >> buf->backend.num_subbuf_order);
 
 	buf->commit_hot =
 		kzalloc_node(ALIGN(sizeof(*buf->commit_hot)
-				   * chan->backend.num_subbuf,
+				   * buf->backend.num_subbuf,
 				   1 << INTERNODE_CACHE_SHIFT),
 			GFP_KERNEL | __GFP_NOWARN,
-			cpu_to_node(max(cpu, 0)));
+			lib_ring_buffer_cpu_to_node(config, cpu));
 	if (!buf->commit_hot) {
 		ret = -ENOMEM;
 		goto free_chanbuf;
@@ -256,15 +325,26 @@ int lib_ring_buffer_create(struct lib_ring_buffer *buf,
 
 	buf->commit_cold =
 		kzalloc_node(ALIGN(sizeof(*buf->commit_cold)
-				   * chan->backend.num_subbuf,
+				   * buf->backend.num_subbuf,
 				   1 << INTERNODE_CACHE_SHIFT),
 			GFP_KERNEL | __GFP_NOWARN,
-			cpu_to_node(max(cpu, 0)));
+			lib_ring_buffer_cpu_to_node(config, cpu));
 	if (!buf->commit_cold) {
 		ret = -ENOMEM;
 		goto free_commit;
 	}
 
+	buf->reader_slots =
+		kzalloc_node(sizeof(*buf->reader_slots)
+			     * chan->backend.num_reader_sb,
+			GFP_KERNEL | __GFP_NOWARN,
+			lib_ring_buffer_cpu_to_node(config, cpu));
+	if (!buf->reader_slots) {
+		ret = -ENOMEM;
+		goto free_commit_cold;
+	}
+	lib_ring_buffer_reader_slots_reset(buf);
+
 	init_waitqueue_head(&buf->read_wait);
 	init_waitqueue_head(&buf->write_wait);
 	raw_spin_lock_init(&buf->raw_tick_nohz_spinlock);
@@ -294,7 +374,7 @@ int lib_ring_buffer_create(struct lib_ring_buffer *buf,
 	smp_wmb();
 	buf->backend.allocated = 1;
 
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL) {
 		CHAN_WARN_ON(chan, cpumask_test_cpu(cpu,
 			     chan->backend.cpumask));
 		cpumask_set_cpu(cpu, chan->backend.cpumask);
@@ -304,6 +384,8 @@ int lib_ring_buffer_create(struct lib_ring_buffer *buf,
 
 	/* Error handling */
 free_init:
+	kfree(buf->reader_slots);
+free_commit_cold:
 	kfree(buf->commit_cold);
 free_commit:
 	kfree(buf->commit_hot);
@@ -319,10 +401,14 @@ static void switch_buffer_timer(unsigned long data)
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
 	/*
-	 * Only flush buffers periodically if readers are active.
+	 * Only flush buffers periodically if readers are active. Leave
+	 * the buffer alone while channel_resize() replaces its memory.
 	 */
-	if (atomic_long_read(&buf->active_readers))
-		lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+	if (!ACCESS_ONCE(buf->resizing)) {
+		if (atomic_long_read(&buf->active_readers))
+			lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+		lib_ring_buffer_retention_reclaim(buf);
+	}
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU)
 		lttng_mod_timer_pinned(&buf->switch_timer,
@@ -340,6 +426,9 @@ static void lib_ring_buffer_start_switch_timer(struct lib_ring_buffer *buf)
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
+	/* Lazily allocated buffers may not exist yet. */
+	if (!buf->backend.allocated)
+		return;
 	if (!chan->switch_timer_interval || buf->switch_timer_enabled)
 		return;
 
@@ -365,6 +454,8 @@ static void lib_ring_buffer_stop_switch_timer(struct lib_ring_buffer *buf)
 {
 	struct channel *chan = buf->backend.chan;
 
+	if (!buf->backend.allocated)
+		return;
 	if (!chan->switch_timer_interval || !buf->switch_timer_enabled)
 		return;
 
@@ -384,6 +475,7 @@ static void read_buffer_timer(unsigned long data)
 	CHAN_WARN_ON(chan, !buf->backend.allocated);
 
 	if (atomic_long_read(&buf->active_readers)
+	    && !ACCESS_ONCE(buf->resizing)
 	    && lib_ring_buffer_poll_deliver(config, buf, chan)) {
 		wake_up_interruptible(&buf->read_wait);
 		wake_up_interruptible(&chan->read_wait);
@@ -405,6 +497,8 @@ static void lib_ring_buffer_start_read_timer(struct lib_ring_buffer *buf)
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
+	if (!buf->backend.allocated)
+		return;
 	if (config->wakeup != RING_BUFFER_WAKEUP_BY_TIMER
 	    || !chan->read_timer_interval
 	    || buf->read_timer_enabled)
@@ -434,6 +528,8 @@ static void lib_ring_buffer_stop_read_timer(struct lib_ring_buffer *buf)
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
+	if (!buf->backend.allocated)
+		return;
 	if (config->wakeup != RING_BUFFER_WAKEUP_BY_TIMER
 	    || !chan->read_timer_interval
 	    || !buf->read_timer_enabled)
@@ -478,13 +574,20 @@ int lttng_cpuhp_rb_frontend_dead(unsigned int cpu,
 
 	CHAN_WARN_ON(chan, config->alloc == RING_BUFFER_ALLOC_GLOBAL);
 
+	/* Lazily allocated buffers may not exist yet. */
+	if (!buf->backend.allocated)
+		return 0;
 	/*
 	 * Performing a buffer switch on a remote CPU. Performed by
 	 * the CPU responsible for doing the hotunplug after the target
 	 * CPU stopped running completely. Ensures that all data
-	 * from that remote CPU is flushed.
+	 * from that remote CPU is flushed. channel_resize() flushes the
+	 * buffers it resizes itself.
 	 */
-	lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+	rcu_read_lock_sched();
+	if (!ACCESS_ONCE(buf->resizing))
+		lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+	rcu_read_unlock_sched();
 	return 0;
 }
 EXPORT_SYMBOL_GPL(lttng_cpuhp_rb_frontend_dead);
@@ -572,9 +675,13 @@ int lib_ring_buffer_cpu_hp_callback(struct notifier_block *nb,
 		 * Performing a buffer switch on a remote CPU. Performed by
 		 * the CPU responsible for doing the hotunplug after the target
 		 * CPU stopped running completely. Ensures that all data
-		 * from that remote CPU is flushed.
+		 * from that remote CPU is flushed. channel_resize() flushes
+		 * the buffers it resizes itself.
 		 */
-		lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+		rcu_read_lock_sched();
+		if (buf->backend.allocated && !ACCESS_ONCE(buf->resizing))
+			lib_ring_buffer_switch_slow(buf, SWITCH_ACTIVE);
+		rcu_read_unlock_sched();
 		return NOTIFY_OK;
 
 	default:
@@ -617,8 +724,15 @@ static int notrace ring_buffer_tick_nohz_callback(struct notifier_block *nb,
 	}
 
 	buf = channel_get_ring_buffer(config, chan, cpu);
+	/* Lazily allocated buffers may not exist yet. */
+	if (!buf->backend.allocated)
+		return 0;
+	/* Read the allocated flag before the buffer, see lib_ring_buffer_create. */
+	smp_rmb();
 	switch (val) {
 	case TICK_NOHZ_FLUSH:
+		if (ACCESS_ONCE(buf->resizing))
+			break;
 		raw_spin_lock(&buf->raw_tick_nohz_spinlock);
 		if (config->wakeup == RING_BUFFER_WAKEUP_BY_TIMER
 		    && chan->read_timer_interval
@@ -677,6 +791,12 @@ static void channel_unregister_notifiers(struct channel *chan)
 
 	channel_iterator_unregister_notifiers(chan);
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+#ifdef CONFIG_IRQ_WORK
+		if (chan->backend.lazy_alloc) {
+			irq_work_sync(&chan->lazy_alloc_irq_work);
+			cancel_work_sync(&chan->lazy_alloc_work);
+		}
+#endif
 #ifdef CONFIG_NO_HZ
 		/*
 		 * Remove the nohz notifier first, so we are certain we stop
@@ -726,6 +846,16 @@ static void channel_unregister_notifiers(struct channel *chan)
 #endif
 		}
 #endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0)) */
+	} else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE) {
+		int node;
+
+		for_each_channel_node(node, chan) {
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(config, chan, node);
+
+			lib_ring_buffer_stop_switch_timer(buf);
+			lib_ring_buffer_stop_read_timer(buf);
+		}
 	} else {
 		struct lib_ring_buffer *buf = chan->backend.buf;
 
@@ -753,11 +883,11 @@ void lib_ring_buffer_set_quiescent_channel(struct channel *chan)
 	int cpu;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL) {
 		get_online_cpus();
 		for_each_channel_cpu(cpu, chan) {
-			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
-							      cpu);
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(config, chan, cpu);
 
 			lib_ring_buffer_set_quiescent(buf);
 		}
@@ -775,11 +905,11 @@ void lib_ring_buffer_clear_quiescent_channel(struct channel *chan)
 	int cpu;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL) {
 		get_online_cpus();
 		for_each_channel_cpu(cpu, chan) {
-			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
-							      cpu);
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(config, chan, cpu);
 
 			lib_ring_buffer_clear_quiescent(buf);
 		}
@@ -799,9 +929,84 @@ static void channel_free(struct channel *chan)
 	}
 	channel_iterator_free(chan);
 	channel_backend_free(&chan->backend);
+	free_cpumask_var(chan->lazy_alloc_pending);
 	kfree(chan);
 }
 
+#ifdef CONFIG_IRQ_WORK
+/*
+ * Enable recording in a lazily allocated buffer just created. Runs on the
+ * buffer cpu, so its writers see the buffer initialized.
+ */
+static
+void lib_ring_buffer_lazy_alloc_enable(void *info)
+{
+	struct lib_ring_buffer *buf = info;
+
+	atomic_dec(&buf->record_disabled);
+}
+
+/*
+ * Create the lazily allocated buffers requested by writers. On failure, the
+ * buffer stays disabled and counts the records it drops, and the next of them
+ * requests the allocation again.
+ */
+static
+void channel_lazy_alloc_work(struct work_struct *work)
+{
+	struct channel *chan = container_of(work, struct channel,
+					    lazy_alloc_work);
+	int cpu, created = 0;
+
+	get_online_cpus();
+	for_each_cpu(cpu, chan->lazy_alloc_pending) {
+		struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
+							  cpu);
+
+		cpumask_clear_cpu(cpu, chan->lazy_alloc_pending);
+		/* Requested again while being created. */
+		if (buf->backend.allocated)
+			continue;
+		if (lib_ring_buffer_create(buf, &chan->backend, cpu)) {
+			printk(KERN_WARNING
+			       "LTTng: cpu %d buffer creation failed\n", cpu);
+			continue;
+		}
+		if (cpu_online(cpu)) {
+			spin_lock(&per_cpu(ring_buffer_nohz_lock, cpu));
+			lib_ring_buffer_start_switch_timer(buf);
+			lib_ring_buffer_start_read_timer(buf);
+			spin_unlock(&per_cpu(ring_buffer_nohz_lock, cpu));
+		}
+		/*
+		 * An offline cpu sees the buffer initialized once brought up.
+		 */
+		if (smp_call_function_single(cpu,
+				lib_ring_buffer_lazy_alloc_enable, buf, 1))
+			lib_ring_buffer_lazy_alloc_enable(buf);
+		created = 1;
+	}
+	put_online_cpus();
+	/* Let the consumer open the new streams. */
+	if (created)
+		wake_up_interruptible(&chan->hp_wait);
+}
+
+/*
+ * Raised by the writer requesting a buffer: the worker cannot be woken up
+ * from every tracing context, and neither can a timer be armed, as the probe
+ * may run with the timer base lock held.
+ */
+static
+void channel_lazy_alloc_irq_work(struct irq_work *entry)
+{
+	struct channel *chan = container_of(entry, struct channel,
+					    lazy_alloc_irq_work);
+
+	schedule_work(&chan->lazy_alloc_work);
+}
+#endif /* CONFIG_IRQ_WORK */
+
 /**
  * channel_create - Create channel.
  * @config: ring buffer instance configuration
@@ -812,6 +1017,12 @@ static void channel_free(struct channel *chan)
  *            configuration. It can be set to NULL for other backends.
  * @subbuf_size: subbuffer size
  * @num_subbuf: number of subbuffers
+ * @num_reader_subbuf: number of sub-buffers the reader can hold at once
+ *                     (0 is the same as 1)
+ * @lazy_alloc: allocate per-cpu buffers on their first record rather than
+ *              for each online cpu. That first record, and the following
+ *              ones until the buffer is created, are dropped and counted
+ *              as lost. Ignored without CONFIG_IRQ_WORK.
  * @switch_timer_interval: Time interval (in us) to fill sub-buffers with
  *                         padding to let readers get those sub-buffers.
  *                         Used for live streaming.
@@ -823,7 +1034,9 @@ static void channel_free(struct channel *chan)
 struct channel *channel_create(const struct lib_ring_buffer_config *config,
 		   const char *name, void *priv, void *buf_addr,
 		   size_t subbuf_size,
-		   size_t num_subbuf, unsigned int switch_timer_interval,
+		   size_t num_subbuf, unsigned int num_reader_subbuf,
+		   int lazy_alloc,
+		   unsigned int switch_timer_interval,
 		   unsigned int read_timer_interval)
 {
 	int ret;
@@ -837,8 +1050,22 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 	if (!chan)
 		return NULL;
 
+#ifdef CONFIG_IRQ_WORK
+	if (lazy_alloc && config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+		if (!zalloc_cpumask_var(&chan->lazy_alloc_pending, GFP_KERNEL))
+			goto error;
+		INIT_WORK(&chan->lazy_alloc_work, channel_lazy_alloc_work);
+		init_irq_work(&chan->lazy_alloc_irq_work,
+			      channel_lazy_alloc_irq_work);
+	}
+#else
+	/* Writers request the buffers through irq_work. */
+	lazy_alloc = 0;
+#endif
+
 	ret = channel_backend_init(&chan->backend, name, config, priv,
-				   subbuf_size, num_subbuf);
+				   subbuf_size, num_subbuf, num_reader_subbuf,
+				   lazy_alloc);
 	if (ret)
 		goto error;
 
@@ -846,12 +1073,12 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 	if (ret)
 		goto error_free_backend;
 
-	chan->commit_count_mask = (~0UL >> chan->backend.num_subbuf_order);
 	chan->switch_timer_interval = usecs_to_jiffies(switch_timer_interval);
 	chan->read_timer_interval = usecs_to_jiffies(read_timer_interval);
 	kref_init(&chan->ref);
 	init_waitqueue_head(&chan->read_wait);
 	init_waitqueue_head(&chan->hp_wait);
+	mutex_init(&chan->resize_mutex);
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,10,0))
@@ -912,7 +1139,16 @@ struct channel *channel_create(const struct lib_ring_buffer_config *config,
 		atomic_notifier_chain_register(&tick_nohz_notifier,
 				       &chan->tick_nohz_notifier);
 #endif /* defined(CONFIG_NO_HZ) && defined(CONFIG_LIB_RING_BUFFER) */
+	} else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE) {
+		int node;
+
+		for_each_channel_node(node, chan) {
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(config, chan, node);
 
+			lib_ring_buffer_start_switch_timer(buf);
+			lib_ring_buffer_start_read_timer(buf);
+		}
 	} else {
 		struct lib_ring_buffer *buf = chan->backend.buf;
 
@@ -932,6 +1168,7 @@ cpuhp_prepare_error:
 error_free_backend:
 	channel_backend_free(&chan->backend);
 error:
+	free_cpumask_var(chan->lazy_alloc_pending);
 	kfree(chan);
 	return NULL;
 }
@@ -963,14 +1200,14 @@ void *channel_destroy(struct channel *chan)
 
 	channel_unregister_notifiers(chan);
 
-	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU) {
+	if (config->alloc != RING_BUFFER_ALLOC_GLOBAL) {
 		/*
 		 * No need to hold cpu hotplug, because all notifiers have been
 		 * unregistered.
 		 */
 		for_each_channel_cpu(cpu, chan) {
-			struct lib_ring_buffer *buf = per_cpu_ptr(chan->backend.buf,
-							      cpu);
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(config, chan, cpu);
 
 			if (config->cb.buffer_finalize)
 				config->cb.buffer_finalize(buf,
@@ -1014,11 +1251,446 @@ struct lib_ring_buffer *channel_get_ring_buffer(
 {
 	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL)
 		return chan->backend.buf;
+	else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE)
+		return &chan->backend.buf[cpu];	/* cpu is the node */
 	else
 		return per_cpu_ptr(chan->backend.buf, cpu);
 }
 EXPORT_SYMBOL_GPL(channel_get_ring_buffer);
 
+/*
+ * Interval at which channel_resize() checks whether the buffer being resized
+ * has a reader to install its new memory.
+ */
+#define RESIZE_READER_CHECK_MS		100
+
+/* New memory of a buffer, prepared by channel_resize() */
+struct lib_ring_buffer_resize {
+	struct lib_ring_buffer_backend backend;
+	struct commit_counters_hot *commit_hot;
+	struct commit_counters_cold *commit_cold;
+	struct completion installed;	/* Memory taken by the buffer */
+};
+
+/*
+ * Buffer resized by channel_resize() for index @cpu, or NULL. Called with
+ * cpu hotplug held.
+ */
+static
+struct lib_ring_buffer *channel_resize_get_buffer(struct channel *chan,
+						   int cpu)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL)
+		return cpu ? NULL : chan->backend.buf;
+	if (!cpumask_test_cpu(cpu, chan->backend.cpumask))
+		return NULL;
+	return channel_get_ring_buffer(config, chan, cpu);
+}
+
+static
+int lib_ring_buffer_resize_alloc(struct lib_ring_buffer *buf,
+				 struct lib_ring_buffer_resize *rs,
+				 size_t num_subbuf)
+{
+	const struct lib_ring_buffer_config *config =
+			&buf->backend.chan->backend.config;
+	int node = lib_ring_buffer_cpu_to_node(config, buf->backend.cpu);
+	int ret;
+
+	ret = lib_ring_buffer_backend_resize_alloc(&rs->backend, &buf->backend,
+						   num_subbuf);
+	if (ret)
+		return ret;
+
+	rs->commit_hot =
+		kzalloc_node(ALIGN(sizeof(*rs->commit_hot) * num_subbuf,
+				   1 << INTERNODE_CACHE_SHIFT),
+			GFP_KERNEL | __GFP_NOWARN, node);
+	if (!rs->commit_hot)
+		goto free_backend;
+
+	rs->commit_cold =
+		kzalloc_node(ALIGN(sizeof(*rs->commit_cold) * num_subbuf,
+				   1 << INTERNODE_CACHE_SHIFT),
+			GFP_KERNEL | __GFP_NOWARN, node);
+	if (!rs->commit_cold)
+		goto free_commit;
+
+	init_completion(&rs->installed);
+	return 0;
+
+free_commit:
+	kfree(rs->commit_hot);
+free_backend:
+	lib_ring_buffer_backend_resize_free(&rs->backend);
+	return -ENOMEM;
+}
+
+static
+void lib_ring_buffer_resize_free(struct lib_ring_buffer_resize *rs)
+{
+	kfree(rs->commit_cold);
+	kfree(rs->commit_hot);
+	lib_ring_buffer_backend_resize_free(&rs->backend);
+}
+
+/*
+ * Whether the data not consumed yet fits in the memory posted for @buf. The
+ * channel geometry is the one of that memory, see channel_resize(). In
+ * overwrite mode the oldest sub-buffers are dropped to make room, as the
+ * writers would do.
+ */
+static
+int lib_ring_buffer_resize_fits(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long consumed;
+
+	if (config->mode == RING_BUFFER_OVERWRITE)
+		return 1;
+	consumed = atomic_long_read(&buf->consumed);
+	return v_read(config, &buf->offset) - subbuf_trunc(consumed, chan)
+		<= chan->backend.buf_size;
+}
+
+#ifdef LTTNG_RING_BUFFER_COUNT_EVENTS
+/* Count the records of the sub-buffers from @begin to @end as overwritten. */
+static
+void lib_ring_buffer_resize_count_overrun(struct lib_ring_buffer *buf,
+					  unsigned long begin,
+					  unsigned long end)
+{
+	struct lib_ring_buffer_backend *bufb = &buf->backend;
+	struct channel *chan = bufb->chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long pos, sb_bindex;
+
+	for (pos = begin; pos != end; pos += chan->backend.subbuf_size) {
+		sb_bindex = subbuffer_id_get_index(config,
+				bufb->buf_wsb[subbuf_index(pos, buf)].id);
+		v_add(config, v_read(config,
+				&bufb->array[sb_bindex]->records_unread),
+		      &buf->records_overrun);
+	}
+}
+#else /* LTTNG_RING_BUFFER_COUNT_EVENTS */
+static
+void lib_ring_buffer_resize_count_overrun(struct lib_ring_buffer *buf,
+					  unsigned long begin,
+					  unsigned long end)
+{
+}
+#endif /* #else LTTNG_RING_BUFFER_COUNT_EVENTS */
+
+/*
+ * Move the sub-buffers of @buf not consumed yet into the memory of @rs, and
+ * set up the counters as if the buffer had always been written with the new
+ * geometry. Positions do not change, and neither do the packet sequence
+ * numbers derived from them. The writers are stopped and the write position
+ * is sub-buffer aligned, see lib_ring_buffer_resize().
+ */
+static
+void lib_ring_buffer_resize_install(struct lib_ring_buffer *buf,
+				    struct lib_ring_buffer_resize *rs)
+{
+	struct channel *chan = buf->backend.chan;
+	struct channel_backend *chanb = &chan->backend;
+	const struct lib_ring_buffer_config *config = &chanb->config;
+	unsigned long offset, consumed, begin, cycle, count, idx, i;
+
+	offset = v_read(config, &buf->offset);
+	CHAN_WARN_ON(chan, subbuf_offset(offset, chan));
+	consumed = atomic_long_read(&buf->consumed);
+	begin = subbuf_trunc(consumed, chan);
+	/* Overwrite mode: the oldest sub-buffers which do not fit are lost. */
+	if (offset - begin > rs->backend.buf_size) {
+		lib_ring_buffer_resize_count_overrun(buf, begin,
+				offset - rs->backend.buf_size);
+		begin = offset - rs->backend.buf_size;
+	}
+
+	lib_ring_buffer_backend_resize_install(&buf->backend, &rs->backend,
+					       begin, offset);
+	kfree(buf->commit_hot);
+	kfree(buf->commit_cold);
+	buf->commit_hot = rs->commit_hot;
+	buf->commit_cold = rs->commit_cold;
+	buf->commit_count_mask = (~0UL >> buf->backend.num_subbuf_order);
+
+	/*
+	 * Sub-buffers before the write position have been written once more
+	 * than those after it in the current buffer cycle. In overwrite mode,
+	 * their id holds the last cycle written, as set on delivery.
+	 */
+	cycle = offset >> buf->backend.buf_size_order;
+	idx = subbuf_index(offset, buf);
+	for (i = 0; i < buf->backend.num_subbuf; i++) {
+		count = cycle + (i < idx);
+		v_set(config, &buf->commit_hot[i].cc,
+		      count << chanb->subbuf_size_order);
+		v_set(config, &buf->commit_hot[i].seq,
+		      count << chanb->subbuf_size_order);
+		v_set(config, &buf->commit_cold[i].cc_sb,
+		      count << chanb->subbuf_size_order);
+		buf->backend.buf_cnt[i].seq_cnt = count;
+		if (count)
+			buf->backend.buf_wsb[i].id =
+				subbuffer_id(config, count - 1, 1, i);
+	}
+	lib_ring_buffer_reader_slots_reset(buf);
+
+	if (begin != consumed) {
+		atomic_long_set(&buf->consumed, begin);
+		buf->live_offset = 0;
+		buf->live_header_stale = 0;
+	}
+	buf->full_hint = 0;
+	buf->push_boundary = begin + buf->backend.buf_size;
+}
+
+/*
+ * Install the memory posted by channel_resize() for @buf, if any, once the
+ * reader holds no sub-buffer and the data not consumed yet fits in it.
+ * Called by the reader, or by channel_resize() in its place when the buffer
+ * is not open for reading.
+ */
+static
+void lib_ring_buffer_resize_apply(struct lib_ring_buffer *buf)
+{
+	struct lib_ring_buffer_resize *rs;
+
+	if (likely(!ACCESS_ONCE(buf->resize)))
+		return;
+	/* Read the posted memory before the channel geometry. */
+	smp_rmb();
+	if (buf->get_subbuf || lib_ring_buffer_reader_slots_busy(buf)
+	    || !lib_ring_buffer_resize_fits(buf))
+		return;
+	rs = xchg(&buf->resize, NULL);
+	if (!rs)
+		return;		/* Taken back by channel_resize() */
+	lib_ring_buffer_resize_install(buf, rs);
+	complete(&rs->installed);
+}
+
+/*
+ * Resize @buf to @num_subbuf sub-buffers. The buffer writers are stopped
+ * and its last packet delivered, then the memory is posted for the reader
+ * to install. Other buffers of the channel keep recording meanwhile.
+ */
+static
+int lib_ring_buffer_resize(struct lib_ring_buffer *buf, size_t num_subbuf)
+{
+	struct channel *chan = buf->backend.chan;
+	struct lib_ring_buffer_resize *rs;
+	long timeout;
+	int ret;
+
+	if (buf->backend.num_subbuf == num_subbuf)
+		return 0;
+	rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+	if (!rs)
+		return -ENOMEM;
+	ret = lib_ring_buffer_resize_alloc(buf, rs, num_subbuf);
+	if (ret)
+		goto end;
+
+	/*
+	 * Writers and timers run with preemption disabled: once they are
+	 * done, only the reader and the flush below touch the buffer. The
+	 * writers which see it disabled see it resizing, and count their
+	 * record in records_lost_resize.
+	 */
+	ACCESS_ONCE(buf->resizing) = 1;
+	smp_wmb();
+	atomic_inc(&buf->record_disabled);
+	synchronize_sched();
+	lib_ring_buffer_switch_remote(buf);
+
+	/* The xchg() full barrier orders the flush before the posting. */
+	xchg(&buf->resize, rs);
+	wake_up_interruptible(&buf->read_wait);
+	wake_up_interruptible(&chan->read_wait);
+
+	for (;;) {
+		timeout = wait_for_completion_interruptible_timeout(
+				&rs->installed,
+				msecs_to_jiffies(RESIZE_READER_CHECK_MS));
+		if (timeout > 0)
+			break;
+		if (!timeout) {
+			/* Install the memory in place of a missing reader. */
+			if (!atomic_long_add_unless(&buf->active_readers, 1, 1))
+				continue;
+			lttng_smp_mb__after_atomic();
+			lib_ring_buffer_resize_apply(buf);
+			lttng_smp_mb__before_atomic();
+			atomic_long_dec(&buf->active_readers);
+			if (!ACCESS_ONCE(buf->resize))
+				break;
+			/* Discard mode data which nobody consumes. */
+			timeout = -EBUSY;
+		}
+		/* Take the memory back, unless it was just installed. */
+		if (xchg(&buf->resize, NULL) == rs) {
+			lib_ring_buffer_resize_free(rs);
+			ret = timeout;
+			goto resume;
+		}
+		wait_for_completion(&rs->installed);
+		break;
+	}
+resume:
+	/* Publish the new memory before writers and timers see it. */
+	smp_mb();
+	atomic_dec(&buf->record_disabled);
+	/* Let the writers which saw it disabled count their record. */
+	synchronize_sched();
+	ACCESS_ONCE(buf->resizing) = 0;
+end:
+	kfree(rs);
+	return ret;
+}
+
+/**
+ * channel_resize - change the number of sub-buffers of a channel
+ * @chan: channel
+ * @num_subbuf: new number of sub-buffers per buffer (power of 2)
+ *
+ * Resizes the channel buffers one at a time to @num_subbuf sub-buffers of the
+ * same size, while their streams stay open. The records written to the buffer
+ * being resized are dropped, and counted in its records_lost_resize, until
+ * its reader installs the new memory (see lib_ring_buffer_snapshot()), which
+ * it does when it holds no sub-buffer. The sub-buffers not consumed yet are handed over to the new
+ * memory: when shrinking a discard mode buffer, the reader first consumes
+ * what does not fit; in overwrite mode, the oldest sub-buffers are dropped.
+ * Buffers which are not open for reading are resized by the caller.
+ *
+ * Returns 0 on success, -EINVAL for an invalid size or a channel
+ * configuration which cannot be resized, -ENOMEM if the new memory cannot be
+ * allocated, -EBUSY if a discard mode buffer which is not open for reading
+ * holds more data than the new size, -ERESTARTSYS if interrupted. On error,
+ * the buffers already resized keep their new size: calling channel_resize()
+ * again resizes the others.
+ */
+int channel_resize(struct channel *chan, size_t num_subbuf)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct channel_backend *chanb = &chan->backend;
+	struct lib_ring_buffer *buf;
+	int cpu, ret = 0;
+
+	/*
+	 * Lazily allocated buffers are created concurrently, channel-wide
+	 * mappings outlive the streams and the iterators keep per-buffer
+	 * read state.
+	 */
+	if (chanb->lazy_alloc || config->output == RING_BUFFER_MMAP
+	    || config->output == RING_BUFFER_ITERATOR)
+		return -EINVAL;
+	if (!num_subbuf || (num_subbuf & (num_subbuf - 1)))
+		return -EINVAL;
+	if (config->mode == RING_BUFFER_OVERWRITE && num_subbuf < 2)
+		return -EINVAL;
+	if (num_subbuf < chanb->num_reader_sb)
+		return -EINVAL;
+	ret = subbuffer_id_check_index(config,
+				       num_subbuf + chanb->num_reader_sb);
+	if (ret)
+		return ret;
+
+	mutex_lock(&chan->resize_mutex);
+	/*
+	 * Buffers allocated from now on by cpu hotplug get the new size, and
+	 * readers check against it whether the data fits in the new memory.
+	 */
+	get_online_cpus();
+	chanb->num_subbuf = num_subbuf;
+	chanb->num_subbuf_order = get_count_order(num_subbuf);
+	chanb->buf_size = num_subbuf * chanb->subbuf_size;
+	chanb->buf_size_order = get_count_order(chanb->buf_size);
+	put_online_cpus();
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		/* Buffers are only freed with the channel. */
+		get_online_cpus();
+		buf = channel_resize_get_buffer(chan, cpu);
+		put_online_cpus();
+		if (!buf)
+			continue;
+		ret = lib_ring_buffer_resize(buf, num_subbuf);
+		if (ret)
+			break;
+	}
+	mutex_unlock(&chan->resize_mutex);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(channel_resize);
+
+/*
+ * A buffer being resized is reported as deliverable while its new memory is
+ * posted, so its reader comes and installs it. Its memory must not be read
+ * meanwhile. Called within rcu_read_lock_sched(), see lib_ring_buffer_resize().
+ */
+static
+int channel_poll_deliver_buf(const struct lib_ring_buffer_config *config,
+			     struct lib_ring_buffer *buf,
+			     struct channel *chan)
+{
+	if (unlikely(ACCESS_ONCE(buf->resizing)))
+		return !!ACCESS_ONCE(buf->resize);
+	return lib_ring_buffer_poll_deliver(config, buf, chan);
+}
+
+/**
+ * channel_poll_deliver_mask - find buffers with deliverable sub-buffers
+ * @chan: channel
+ * @mask: bitmap of nr_cpu_ids bits, or NULL
+ *
+ * Sets the bit of each per-cpu buffer (bit 0 for a global buffer, the node
+ * bit for per-node buffers) whose
+ * sub-buffer at the consumer position is fully committed, or which waits
+ * for its reader to install the memory posted by channel_resize(). As for
+ * lib_ring_buffer_poll_deliver(), the result is only statistically
+ * correct: readers must still rely on get_subbuf. Returns the number of
+ * buffers with deliverable data.
+ */
+int channel_poll_deliver_mask(struct channel *chan, unsigned long *mask)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer *buf;
+	int cpu, count = 0;
+
+	if (mask)
+		bitmap_zero(mask, nr_cpu_ids);
+	/* Excludes channel_resize() replacing the buffer memory. */
+	rcu_read_lock_sched();
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL) {
+		buf = chan->backend.buf;
+		if (channel_poll_deliver_buf(config, buf, chan)) {
+			if (mask)
+				__set_bit(0, mask);
+			count++;
+		}
+		goto end;
+	}
+	for_each_channel_cpu(cpu, chan) {
+		buf = channel_get_ring_buffer(config, chan, cpu);
+		if (channel_poll_deliver_buf(config, buf, chan)) {
+			if (mask)
+				__set_bit(cpu, mask);
+			count++;
+		}
+	}
+end:
+	rcu_read_unlock_sched();
+	return count;
+}
+EXPORT_SYMBOL_GPL(channel_poll_deliver_mask);
+
 int lib_ring_buffer_open_read(struct lib_ring_buffer *buf)
 {
 	struct channel *chan = buf->backend.chan;
@@ -1039,6 +1711,9 @@ void lib_ring_buffer_release_read(struct lib_ring_buffer *buf)
 	struct channel *chan = buf->backend.chan;
 
 	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+	buf->splice_subbufs = 0;
+	buf->live_offset = 0;
+	buf->live_header_stale = 0;
 	lttng_smp_mb__before_atomic();
 	atomic_long_dec(&buf->active_readers);
 	kref_put(&chan->ref, channel_release);
@@ -1056,6 +1731,67 @@ static void remote_mb(void *info)
 	smp_mb();
 }
 
+/*
+ * Get the end timestamp of the packet at position @pos. Returns 0 if that
+ * packet has not been delivered, or is being overwritten.
+ */
+static
+int lib_ring_buffer_packet_timestamp_end(struct lib_ring_buffer *buf,
+					 unsigned long pos, u64 *tsc)
+{
+	struct channel *chan = buf->backend.chan;
+	struct lib_ring_buffer_backend *bufb = &buf->backend;
+	unsigned long cycle_mask = ~0UL >> buf->backend.buf_size_order;
+	unsigned long idx = subbuf_index(pos, buf), cycle;
+	uint64_t seq_cnt;
+
+	/* The packet counter counts the packet at pos once delivered. */
+	cycle = (pos >> buf->backend.buf_size_order) + 1;
+	seq_cnt = ACCESS_ONCE(bufb->buf_cnt[idx].seq_cnt);
+	if (((unsigned long) seq_cnt - cycle) & cycle_mask)
+		return 0;
+	smp_rmb();
+	*tsc = ACCESS_ONCE(bufb->buf_cnt[idx].timestamp_end);
+	smp_rmb();
+	return ACCESS_ONCE(bufb->buf_cnt[idx].seq_cnt) == seq_cnt;
+}
+
+/*
+ * Overwrite mode retention: move the consumed position past the packets
+ * which ended more than chan->retention ago. Such packets would be
+ * overwritten anyway on a busier buffer; dropping them keeps the data of all
+ * buffers within a comparable time window.
+ */
+static
+void lib_ring_buffer_retention_reclaim(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	u64 retention = ACCESS_ONCE(chan->retention), now, tsc;
+	unsigned long consumed, write_offset, pos;
+
+	if (config->mode != RING_BUFFER_OVERWRITE || !retention)
+		return;
+	now = config->cb.ring_buffer_clock_read(chan);
+	if (now <= retention)
+		return;
+	consumed = atomic_long_read(&buf->consumed);
+	write_offset = v_read(config, &buf->offset);
+	for (pos = consumed;
+	     (long) (subbuf_trunc(write_offset, chan) - pos) > 0;
+	     pos += chan->backend.subbuf_size) {
+		if (!lib_ring_buffer_packet_timestamp_end(buf, pos, &tsc)
+		    || tsc >= now - retention)
+			break;
+	}
+	/*
+	 * Writers push the consumed position concurrently: only move it
+	 * forward from the value we started from.
+	 */
+	if (pos != consumed)
+		atomic_long_cmpxchg(&buf->consumed, consumed, pos);
+}
+
 /**
  * lib_ring_buffer_snapshot - save subbuffer position snapshot (for read)
  * @buf: ring buffer
@@ -1075,6 +1811,8 @@ int lib_ring_buffer_snapshot(struct lib_ring_buffer *buf,
 	unsigned long consumed_cur, write_offset;
 	int finalized;
 
+	lib_ring_buffer_resize_apply(buf);
+	lib_ring_buffer_retention_reclaim(buf);
 retry:
 	finalized = ACCESS_ONCE(buf->finalized);
 	/*
@@ -1119,6 +1857,45 @@ nodata:
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_snapshot);
 
+/**
+ * lib_ring_buffer_snapshot_since - snapshot of the packets ending after a time
+ * @buf: ring buffer
+ * @since: timestamp lower bound, in ring buffer clock units
+ * @consumed: consumed count indicating the position where to read
+ * @produced: produced count, indicates position when to stop reading
+ *
+ * Same as lib_ring_buffer_snapshot(), but @consumed is moved forward to the
+ * oldest packet of the snapshot which ends at or after @since: the packets
+ * before it, entirely older than @since, are left out. The selection uses the
+ * end timestamps of the packets delivered, and stops at the first packet
+ * being overwritten concurrently.
+ */
+int lib_ring_buffer_snapshot_since(struct lib_ring_buffer *buf, u64 since,
+				   unsigned long *consumed,
+				   unsigned long *produced)
+{
+	struct channel *chan = buf->backend.chan;
+	unsigned long start, pos;
+	u64 tsc;
+	int ret;
+
+	ret = lib_ring_buffer_snapshot(buf, consumed, produced);
+	if (ret)
+		return ret;
+
+	/* Walk back from the most recent packet. */
+	for (start = *produced; (long) (start - *consumed) > 0; start = pos) {
+		pos = start - chan->backend.subbuf_size;
+		if (!lib_ring_buffer_packet_timestamp_end(buf, pos, &tsc)
+		    || tsc < since)
+			break;
+	}
+	if ((long) (start - *consumed) > 0)
+		*consumed = start;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_snapshot_since);
+
 /**
  * lib_ring_buffer_put_snapshot - move consumed counter forward
  *
@@ -1144,45 +1921,26 @@ void lib_ring_buffer_move_consumer(struct lib_ring_buffer *buf,
 	while ((long) consumed - (long) consumed_new < 0)
 		consumed = atomic_long_cmpxchg(&buf->consumed, consumed,
 					       consumed_new);
+	/*
+	 * Space was freed: the cmpxchg full barrier orders the consumed count
+	 * update before the full hint read. Pairs with
+	 * lib_ring_buffer_set_full_hint().
+	 */
+	if (unlikely(ACCESS_ONCE(buf->full_hint)))
+		ACCESS_ONCE(buf->full_hint) = 0;
 	/* Wake-up the metadata producer */
 	wake_up_interruptible(&buf->write_wait);
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_move_consumer);
 
-/**
- * lib_ring_buffer_get_subbuf - get exclusive access to subbuffer for reading
- * @buf: ring buffer
- * @consumed: consumed count indicating the position where to read
- *
- * Returns -ENODATA if buffer is finalized, -EAGAIN if there is currently no
- * data to read at consumed position, or 0 if the get operation succeeds.
- * Busy-loop trying to get data if the tick_nohz sequence lock is held.
+/*
+ * Reader-side barrier ordering the commit count reads before the reads of
+ * the buffer data and of the write offset.
  */
-int lib_ring_buffer_get_subbuf(struct lib_ring_buffer *buf,
-			       unsigned long consumed)
+static
+void lib_ring_buffer_read_barrier(const struct lib_ring_buffer_config *config,
+				  struct lib_ring_buffer *buf)
 {
-	struct channel *chan = buf->backend.chan;
-	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	unsigned long consumed_cur, consumed_idx, commit_count, write_offset;
-	int ret;
-	int finalized;
-
-	if (buf->get_subbuf) {
-		/*
-		 * Reader is trying to get a subbuffer twice.
-		 */
-		CHAN_WARN_ON(chan, 1);
-		return -EBUSY;
-	}
-retry:
-	finalized = ACCESS_ONCE(buf->finalized);
-	/*
-	 * Read finalized before counters.
-	 */
-	smp_rmb();
-	consumed_cur = atomic_long_read(&buf->consumed);
-	consumed_idx = subbuf_index(consumed, chan);
-	commit_count = v_read(config, &buf->commit_cold[consumed_idx].cc_sb);
 	/*
 	 * Make sure we read the commit count before reading the buffer
 	 * data and the write offset. Correct consumed offset ordering
@@ -1245,6 +2003,89 @@ retry:
 		 */
 		smp_rmb();
 	}
+}
+
+static
+int lib_ring_buffer_reader_slot_held(struct lib_ring_buffer *buf,
+				     unsigned int slot)
+{
+	if (slot == buf->reader_slot)
+		return buf->get_subbuf;
+	return buf->reader_slots[slot].held;
+}
+
+static
+unsigned long lib_ring_buffer_reader_slot_consumed(struct lib_ring_buffer *buf,
+						   unsigned int slot)
+{
+	if (slot == buf->reader_slot)
+		return buf->get_subbuf_consumed;
+	return buf->reader_slots[slot].consumed;
+}
+
+/*
+ * Writers may move the consumed count up to the position published in the
+ * consumer page, but never past a sub-buffer held by the reader: the limit is
+ * @limit, or the start of the oldest sub-buffer held if it comes before.
+ */
+static
+void lib_ring_buffer_consumer_page_set_limit(struct lib_ring_buffer *buf,
+					     struct channel *chan,
+					     unsigned long limit)
+{
+	unsigned long consumed;
+	unsigned int i;
+
+	for (i = 0; i < chan->backend.num_reader_sb; i++) {
+		if (!lib_ring_buffer_reader_slot_held(buf, i))
+			continue;
+		consumed = subbuf_trunc(lib_ring_buffer_reader_slot_consumed(buf, i),
+					chan);
+		if ((long) (consumed - limit) < 0)
+			limit = consumed;
+	}
+	atomic_long_set(&buf->consumer_page_limit, limit);
+}
+
+/**
+ * lib_ring_buffer_get_subbuf - get exclusive access to subbuffer for reading
+ * @buf: ring buffer
+ * @consumed: consumed count indicating the position where to read
+ *
+ * Returns -ENODATA if buffer is finalized, -EAGAIN if there is currently no
+ * data to read at consumed position, or 0 if the get operation succeeds.
+ * Busy-loop trying to get data if the tick_nohz sequence lock is held.
+ */
+int lib_ring_buffer_get_subbuf(struct lib_ring_buffer *buf,
+			       unsigned long consumed)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long consumed_cur, consumed_idx, commit_count, write_offset;
+	int ret;
+	int finalized;
+
+	if (buf->get_subbuf) {
+		/*
+		 * Reader is trying to get a subbuffer twice.
+		 */
+		CHAN_WARN_ON(chan, 1);
+		return -EBUSY;
+	}
+retry:
+	finalized = ACCESS_ONCE(buf->finalized);
+	/*
+	 * Read finalized before counters.
+	 */
+	smp_rmb();
+	consumed_cur = atomic_long_read(&buf->consumed);
+	consumed_idx = subbuf_index(consumed, buf);
+	commit_count = v_read(config, &buf->commit_cold[consumed_idx].cc_sb);
+	/*
+	 * Make sure we read the commit count before reading the buffer
+	 * data and the write offset.
+	 */
+	lib_ring_buffer_read_barrier(config, buf);
 
 	write_offset = v_read(config, &buf->offset);
 
@@ -1261,9 +2102,9 @@ retry:
 	 * already fully committed.
 	 */
 	if (((commit_count - chan->backend.subbuf_size)
-	     & chan->commit_count_mask)
-	    - (buf_trunc(consumed, chan)
-	       >> chan->backend.num_subbuf_order)
+	     & buf->commit_count_mask)
+	    - (buf_trunc(consumed, buf)
+	       >> buf->backend.num_subbuf_order)
 	    != 0)
 		goto nodata;
 
@@ -1283,13 +2124,16 @@ retry:
 	 * looking for matches the one contained in the subbuffer id.
 	 */
 	ret = update_read_sb_index(config, &buf->backend, &chan->backend,
-				   consumed_idx, buf_trunc_val(consumed, chan));
+				   consumed_idx, buf_trunc_val(consumed, buf));
 	if (ret)
 		goto retry;
 	subbuffer_id_clear_noref(config, &buf->backend.buf_rsb.id);
 
 	buf->get_subbuf_consumed = consumed;
 	buf->get_subbuf = 1;
+	if (buf->consumer_page)
+		lib_ring_buffer_consumer_page_set_limit(buf, chan,
+				subbuf_trunc(consumed, chan));
 
 	return 0;
 
@@ -1307,6 +2151,237 @@ nodata:
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_get_subbuf);
 
+/**
+ * lib_ring_buffer_enable_consumer_page - enable the consumer position page
+ * @buf: ring buffer
+ *
+ * Once enabled, the consumer can publish its consumed position in a page
+ * shared with the kernel instead of calling lib_ring_buffer_put_subbuf() and
+ * lib_ring_buffer_move_consumer(). Only supported in discard mode: in
+ * overwrite mode, the reader sub-buffer must be exchanged with the writer by
+ * put_subbuf.
+ *
+ * Returns 0 on success, -EINVAL if not supported, -ENOMEM on allocation
+ * failure.
+ */
+int lib_ring_buffer_enable_consumer_page(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer_consumer_page *consumer_page;
+	struct page *page;
+	unsigned long consumed;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	if (config->mode != RING_BUFFER_DISCARD)
+		return -EINVAL;
+	if (buf->consumer_page)
+		return 0;
+	page = alloc_pages_node(lib_ring_buffer_cpu_to_node(config, buf->backend.cpu),
+				GFP_KERNEL | __GFP_ZERO, 0);
+	if (!page)
+		return -ENOMEM;
+	consumer_page = page_address(page);
+	consumed = atomic_long_read(&buf->consumed);
+	consumer_page->consumed = consumed;
+	lib_ring_buffer_consumer_page_set_limit(buf, chan, consumed);
+	/*
+	 * Concurrent callers race to publish their page, the loser frees its
+	 * own. The cmpxchg barrier orders the page content and limit before
+	 * the page is seen by the writers.
+	 */
+	if (cmpxchg(&buf->consumer_page, NULL, consumer_page) != NULL)
+		__free_page(page);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_enable_consumer_page);
+
+/*
+ * Read the position published in the consumer page. It is only trusted if
+ * it is sub-buffer aligned and does not go past @limit.
+ */
+static
+int lib_ring_buffer_consumer_page_read(struct lib_ring_buffer *buf,
+				       struct channel *chan,
+				       unsigned long limit,
+				       unsigned long *consumed)
+{
+	struct lib_ring_buffer_consumer_page *consumer_page;
+	unsigned long consumed_new;
+
+	consumer_page = ACCESS_ONCE(buf->consumer_page);
+	smp_read_barrier_depends();
+	consumed_new = (unsigned long) ACCESS_ONCE(consumer_page->consumed);
+	if (subbuf_offset(consumed_new, chan)
+	    || (long) (consumed_new - limit) > 0)
+		return -EINVAL;
+	*consumed = consumed_new;
+	return 0;
+}
+
+/**
+ * lib_ring_buffer_consumer_page_put - apply the consumer published position
+ * @buf: ring buffer
+ *
+ * Releases the sub-buffer held by the reader if the consumer published a
+ * position at or past its end, and moves the consumer position forward.
+ * Called by the reader before getting the next sub-buffer.
+ */
+void lib_ring_buffer_consumer_page_put(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	unsigned long consumed, limit;
+
+	/* The reader may release the sub-buffer it holds. */
+	if (buf->get_subbuf)
+		limit = subbuf_align(buf->get_subbuf_consumed, chan);
+	else
+		limit = atomic_long_read(&buf->consumer_page_limit);
+	if (lib_ring_buffer_consumer_page_read(buf, chan, limit, &consumed))
+		return;
+	if (buf->get_subbuf
+	    && (long) (consumed - subbuf_align(buf->get_subbuf_consumed,
+					       chan)) >= 0)
+		lib_ring_buffer_put_subbuf(buf);
+	lib_ring_buffer_move_consumer(buf, consumed);
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_consumer_page_put);
+
+/**
+ * lib_ring_buffer_enable_packet_index - enable the packet index ring
+ * @buf: ring buffer
+ *
+ * Allocates a ring of packet index entries, twice as many as sub-buffers and
+ * mappable by the consumer. The client then appends an entry for each packet
+ * delivered after this call.
+ *
+ * Returns 0 on success, -ENOMEM on allocation failure.
+ */
+int lib_ring_buffer_enable_packet_index(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer_packet_index *packet_index;
+	unsigned long len, offset;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	if (buf->packet_index)
+		return 0;
+	len = roundup_pow_of_two(2 * buf->backend.num_subbuf);
+	packet_index = vmalloc_user(PAGE_ALIGN(len * sizeof(*packet_index)));
+	if (!packet_index)
+		return -ENOMEM;
+	buf->packet_index_len = len;
+	/* The first packet indexed is the one under the write head. */
+	offset = v_read(config, &buf->offset);
+	lib_ring_buffer_packet_index_init(buf, packet_index,
+		subbuf_trunc(offset, chan) >> chan->backend.subbuf_size_order);
+	/*
+	 * Writers test buf->packet_index locklessly: initialize the ring
+	 * before publishing it.
+	 */
+	smp_wmb();
+	ACCESS_ONCE(buf->packet_index) = packet_index;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_enable_packet_index);
+
+/**
+ * lib_ring_buffer_packet_index_append - append a packet index entry
+ * @buf: ring buffer
+ * @entry: entry to append
+ *
+ * Called by the client when a packet is delivered, if the packet index is
+ * enabled. Overwrites the entry of the packet num_entries packets older.
+ */
+void lib_ring_buffer_packet_index_append(struct lib_ring_buffer *buf,
+		const struct lib_ring_buffer_packet_index *entry)
+{
+	struct lib_ring_buffer_packet_index *packet_index, *slot;
+	unsigned long head, old, next = (unsigned long) entry->seq_num + 1;
+
+	packet_index = ACCESS_ONCE(buf->packet_index);
+	if (!packet_index)
+		return;
+	smp_read_barrier_depends();
+	slot = &packet_index[entry->seq_num & (buf->packet_index_len - 1)];
+	ACCESS_ONCE(slot->seq_num) = ~0ULL;
+	smp_wmb();
+	slot->offset = entry->offset;
+	slot->timestamp_begin = entry->timestamp_begin;
+	slot->timestamp_end = entry->timestamp_end;
+	slot->content_size = entry->content_size;
+	slot->packet_size = entry->packet_size;
+	slot->events_discarded = entry->events_discarded;
+	/* Write the entry before its sequence number. */
+	smp_wmb();
+	ACCESS_ONCE(slot->seq_num) = entry->seq_num;
+
+	/* Packets can be delivered out of order: only move the head forward. */
+	head = atomic_long_read(&buf->packet_index_head);
+	while ((long) (head - next) < 0) {
+		old = atomic_long_cmpxchg(&buf->packet_index_head, head, next);
+		if (old == head)
+			break;
+		head = old;
+	}
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_packet_index_append);
+
+/**
+ * lib_ring_buffer_read_packet_index - read packet index entries
+ * @buf: ring buffer
+ * @entries: user-space array of entries
+ * @count: capacity of @entries
+ * @nr_read: number of entries read (output)
+ *
+ * Copies the entries following the last one read, in packet order, up to the
+ * first one not written yet. Entries overwritten before being read are
+ * skipped.
+ *
+ * Returns 0 on success, -EINVAL if the packet index is not enabled, -EFAULT
+ * on copy failure.
+ */
+int lib_ring_buffer_read_packet_index(struct lib_ring_buffer *buf,
+		struct lib_ring_buffer_packet_index __user *entries,
+		unsigned int count, unsigned int *nr_read)
+{
+	struct channel *chan = buf->backend.chan;
+	struct lib_ring_buffer_packet_index entry, *slot;
+	unsigned long head, read;
+	unsigned int n;
+	uint64_t seq_num;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	if (!buf->packet_index)
+		return -EINVAL;
+	head = atomic_long_read(&buf->packet_index_head);
+	read = buf->packet_index_read;
+	if ((long) (head - read) > (long) buf->packet_index_len)
+		read = head - buf->packet_index_len;
+	for (n = 0; n < count && read != head; n++, read++) {
+		slot = &buf->packet_index[read & (buf->packet_index_len - 1)];
+		seq_num = ACCESS_ONCE(slot->seq_num);
+		/* Read the sequence number before the entry. */
+		smp_rmb();
+		entry = *slot;
+		smp_rmb();
+		if ((unsigned long) seq_num != read
+		    || ACCESS_ONCE(slot->seq_num) != seq_num)
+			break;
+		entry.seq_num = seq_num;
+		if (copy_to_user(&entries[n], &entry, sizeof(entry)))
+			return -EFAULT;
+	}
+	buf->packet_index_read = read;
+	*nr_read = n;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_read_packet_index);
+
 /**
  * lib_ring_buffer_put_subbuf - release exclusive subbuffer access
  * @buf: ring buffer
@@ -1354,16 +2429,389 @@ void lib_ring_buffer_put_subbuf(struct lib_ring_buffer *buf)
 	 * currently have: it has become invalid to try reading this sub-buffer
 	 * consumed count value anyway.
 	 */
-	consumed_idx = subbuf_index(consumed, chan);
+	consumed_idx = subbuf_index(consumed, buf);
 	update_read_sb_index(config, &buf->backend, &chan->backend,
-			     consumed_idx, buf_trunc_val(consumed, chan));
+			     consumed_idx, buf_trunc_val(consumed, buf));
 	/*
 	 * update_read_sb_index return value ignored. Don't exchange sub-buffer
 	 * if the writer concurrently updated it.
 	 */
+	if (buf->consumer_page)
+		lib_ring_buffer_consumer_page_set_limit(buf, chan,
+				subbuf_align(consumed, chan));
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_put_subbuf);
 
+/*
+ * Make @slot the reader slot on which get_subbuf, put_subbuf and the
+ * accessors of the sub-buffer being read operate.
+ */
+static
+void lib_ring_buffer_reader_slot_switch(struct lib_ring_buffer *buf,
+					unsigned int slot)
+{
+	struct lib_ring_buffer_backend *bufb = &buf->backend;
+	struct lib_ring_buffer_reader_slot *cur, *next;
+
+	if (slot == buf->reader_slot)
+		return;
+	cur = &buf->reader_slots[buf->reader_slot];
+	cur->rsb = bufb->buf_rsb;
+	cur->consumed = buf->get_subbuf_consumed;
+	cur->held = buf->get_subbuf;
+	next = &buf->reader_slots[slot];
+	bufb->buf_rsb = next->rsb;
+	buf->get_subbuf_consumed = next->consumed;
+	buf->get_subbuf = next->held;
+	buf->reader_slot = slot;
+}
+
+/**
+ * lib_ring_buffer_get_next_subbuf_slot - get the next sub-buffer in a slot
+ * @buf: ring buffer
+ * @slot: reader slot holding the sub-buffer (output)
+ *
+ * Gets the sub-buffer following the last one obtained through a reader slot,
+ * or the sub-buffer at the consumed position if no slot is held, into a free
+ * reader slot, which becomes the selected one. The consumed position is not
+ * moved: it is moved by lib_ring_buffer_put_subbuf_slot().
+ *
+ * Returns -EBUSY if all reader slots are held, otherwise the same as
+ * lib_ring_buffer_get_subbuf(). The selected slot is left unchanged on
+ * error.
+ */
+int lib_ring_buffer_get_next_subbuf_slot(struct lib_ring_buffer *buf,
+					 unsigned int *slot)
+{
+	struct channel *chan = buf->backend.chan;
+	unsigned long consumed, produced;
+	unsigned int i, free_slot, selected;
+	int ret, held = 0;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	free_slot = chan->backend.num_reader_sb;
+	for (i = 0; i < chan->backend.num_reader_sb; i++) {
+		if (lib_ring_buffer_reader_slot_held(buf, i))
+			held = 1;
+		else if (free_slot == chan->backend.num_reader_sb)
+			free_slot = i;
+	}
+	if (free_slot == chan->backend.num_reader_sb)
+		return -EBUSY;
+
+	ret = lib_ring_buffer_snapshot(buf, &consumed, &produced);
+	if (ret)
+		return ret;
+	/*
+	 * In overwrite mode, the writer may have pushed the consumed position
+	 * past the sub-buffers still held by the reader.
+	 */
+	if (held && (long) (buf->reader_next - consumed) > 0)
+		consumed = buf->reader_next;
+
+	selected = buf->reader_slot;
+	lib_ring_buffer_reader_slot_switch(buf, free_slot);
+	ret = lib_ring_buffer_get_subbuf(buf, consumed);
+	if (ret) {
+		lib_ring_buffer_reader_slot_switch(buf, selected);
+		return ret;
+	}
+	buf->reader_next = subbuf_align(consumed, chan);
+	*slot = free_slot;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_get_next_subbuf_slot);
+
+/**
+ * lib_ring_buffer_select_subbuf_slot - select a reader slot
+ * @buf: ring buffer
+ * @slot: reader slot
+ *
+ * Returns -EINVAL if @slot is out of range.
+ */
+int lib_ring_buffer_select_subbuf_slot(struct lib_ring_buffer *buf,
+				       unsigned int slot)
+{
+	struct channel *chan = buf->backend.chan;
+
+	if (slot >= chan->backend.num_reader_sb)
+		return -EINVAL;
+	lib_ring_buffer_reader_slot_switch(buf, slot);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_select_subbuf_slot);
+
+/**
+ * lib_ring_buffer_put_subbuf_slot - release the sub-buffer held in a slot
+ * @buf: ring buffer
+ * @slot: reader slot
+ *
+ * Slots can be released in any order. The consumed position is moved to the
+ * oldest sub-buffer still held, or past the last sub-buffer obtained if no
+ * slot is held anymore. The selected slot is left unchanged.
+ *
+ * Returns -EINVAL if @slot is out of range or not held.
+ */
+int lib_ring_buffer_put_subbuf_slot(struct lib_ring_buffer *buf,
+				    unsigned int slot)
+{
+	struct channel *chan = buf->backend.chan;
+	unsigned long consumed_new, consumed;
+	unsigned int i, selected = buf->reader_slot;
+	int held = 0;
+
+	if (slot >= chan->backend.num_reader_sb
+	    || !lib_ring_buffer_reader_slot_held(buf, slot))
+		return -EINVAL;
+
+	lib_ring_buffer_reader_slot_switch(buf, slot);
+	lib_ring_buffer_put_subbuf(buf);
+	lib_ring_buffer_reader_slot_switch(buf, selected);
+
+	consumed_new = buf->reader_next;
+	for (i = 0; i < chan->backend.num_reader_sb; i++) {
+		if (!lib_ring_buffer_reader_slot_held(buf, i))
+			continue;
+		consumed = lib_ring_buffer_reader_slot_consumed(buf, i);
+		consumed = subbuf_trunc(consumed, chan);
+		if (!held || (long) (consumed - consumed_new) < 0)
+			consumed_new = consumed;
+		held = 1;
+	}
+	lib_ring_buffer_move_consumer(buf, consumed_new);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_put_subbuf_slot);
+
+/**
+ * lib_ring_buffer_reader_slots_busy - check for sub-buffers held in other slots
+ * @buf: ring buffer
+ *
+ * The sub-buffer getters and put operations which work on the consumed
+ * position, as well as splice, must not run while the reader holds
+ * sub-buffers in slots other than the selected one.
+ *
+ * Returns 1 if a reader slot other than the selected one is held.
+ */
+int lib_ring_buffer_reader_slots_busy(struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	unsigned int i;
+
+	for (i = 0; i < chan->backend.num_reader_sb; i++) {
+		if (i != buf->reader_slot
+		    && lib_ring_buffer_reader_slot_held(buf, i))
+			return 1;
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_reader_slots_busy);
+
+/**
+ * lib_ring_buffer_get_subbuf_slots - get several sub-buffers into reader slots
+ * @buf: ring buffer
+ * @count: number of sub-buffers got (output)
+ *
+ * Overwrite mode only. Flushes the current sub-buffer, then gets the
+ * readable sub-buffers, oldest first, into reader slots 0 to @count - 1, with
+ * one lib_ring_buffer_get_next_subbuf_slot() each, until the write position
+ * or the last free slot is reached: at most num_reader_sb sub-buffers are
+ * got, the older ones stay in the buffer. Each of them is exchanged with the
+ * spare sub-buffer of its slot, so writers go on into the spare pages while
+ * the ones got are read through mmap, without copy. Releasing the slots with
+ * lib_ring_buffer_put_subbuf_slot() gives the pages back to the buffer as
+ * spares. Slot 0 is left selected.
+ *
+ * Only a channel created with as many reader sub-buffers as sub-buffers gets
+ * all the buffer but the sub-buffer under the write head.
+ *
+ * Returns -EINVAL in discard mode, -EBUSY if a reader slot is held, or the
+ * error of lib_ring_buffer_get_next_subbuf_slot() if no sub-buffer could be
+ * got.
+ */
+int lib_ring_buffer_get_subbuf_slots(struct lib_ring_buffer *buf,
+				     unsigned int *count)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned int i, slot, n = 0;
+	int ret;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	if (config->mode != RING_BUFFER_OVERWRITE)
+		return -EINVAL;
+	for (i = 0; i < chan->backend.num_reader_sb; i++) {
+		if (lib_ring_buffer_reader_slot_held(buf, i))
+			return -EBUSY;
+	}
+
+	lib_ring_buffer_switch_remote(buf);
+	/* Slots are all free: they are taken in order. */
+	do {
+		ret = lib_ring_buffer_get_next_subbuf_slot(buf, &slot);
+		if (!ret)
+			n++;
+	} while (!ret);
+	if (!n)
+		return ret;
+	lib_ring_buffer_reader_slot_switch(buf, 0);
+	*count = n;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_get_subbuf_slots);
+
+/*
+ * Size of the prefix of the sub-buffer under the write head, at @consumed,
+ * in which every reservation has been committed. Returns 0 if the write head
+ * is not in that sub-buffer, or if a reservation is not committed yet.
+ */
+static
+unsigned long lib_ring_buffer_committed_prefix(struct lib_ring_buffer *buf,
+					       unsigned long consumed)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long offset, commit_count, committed;
+
+	offset = v_read(config, &buf->offset);
+	if (subbuf_trunc(offset, chan) != subbuf_trunc(consumed, chan))
+		return 0;
+	/* Read the write offset before the commit count. */
+	smp_rmb();
+	commit_count = v_read(config,
+			&buf->commit_hot[subbuf_index(offset, buf)].cc);
+	lib_ring_buffer_read_barrier(config, buf);
+	/*
+	 * A reservation done after the first offset read could have been
+	 * committed before the commit count read: it must not be counted.
+	 */
+	if (v_read(config, &buf->offset) != offset)
+		return 0;
+	committed = (commit_count
+		     - (buf_trunc(offset, buf) >> buf->backend.num_subbuf_order))
+		    & buf->commit_count_mask;
+	if (committed != subbuf_offset(offset, chan))
+		return 0;
+	return committed;
+}
+
+/**
+ * lib_ring_buffer_live_read - read the committed data of the current packet
+ * @buf: ring buffer
+ * @user_buf: user buffer
+ * @len: size of @user_buf
+ * @packet_offset: offset within the packet of the data copied (output)
+ * @copied: number of bytes copied (output)
+ * @packet_end: set when the packet has been entirely read and consumed
+ *              (output)
+ *
+ * Reads the packet at the consumed position from where the previous live
+ * read stopped. If the packet is complete, copies up to its page-aligned
+ * packet size and consumes it once entirely read. Otherwise, copies the
+ * prefix of the packet under the write head in which every reservation is
+ * committed, so live readers do not have to wait for a sub-buffer switch.
+ * The header of such a packet is only final once the packet is complete: it
+ * is then copied again, at packet offset 0, before the rest of the packet.
+ *
+ * Discard mode only: in overwrite mode the writer may overwrite the packet
+ * under the write head. Returns -EAGAIN if there is no new data, -ENODATA if
+ * the buffer is finalized, -EBUSY if the reader holds a sub-buffer.
+ */
+int lib_ring_buffer_live_read(struct lib_ring_buffer *buf,
+			      char __user *user_buf, size_t len,
+			      unsigned long *packet_offset, size_t *copied,
+			      int *packet_end)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer_backend *bufb = &buf->backend;
+	unsigned long consumed, end;
+	size_t header_size;
+	int ret;
+
+	CHAN_WARN_ON(chan, atomic_long_read(&buf->active_readers) != 1);
+
+	if (config->mode != RING_BUFFER_DISCARD)
+		return -EINVAL;
+	if (buf->get_subbuf)
+		return -EBUSY;
+	if (!access_ok(VERIFY_WRITE, user_buf, len))
+		return -EFAULT;
+	*copied = 0;
+	*packet_end = 0;
+
+	ret = lib_ring_buffer_get_next_subbuf(buf);
+	if (!ret) {
+		/* Complete packet. */
+		if (buf->live_header_stale) {
+			header_size = config->cb.subbuffer_header_size();
+			if (len < header_size) {
+				ret = -EINVAL;
+				goto put;
+			}
+			ret = __lib_ring_buffer_copy_to_user(bufb,
+					buf->cons_snapshot, user_buf,
+					header_size);
+			if (ret)
+				goto put;
+			buf->live_header_stale = 0;
+			*packet_offset = 0;
+			*copied = header_size;
+			goto put;
+		}
+		end = PAGE_ALIGN(lib_ring_buffer_get_read_data_size(config,
+								    buf));
+		*copied = min_t(size_t, len, end - buf->live_offset);
+		ret = __lib_ring_buffer_copy_to_user(bufb,
+				buf->cons_snapshot + buf->live_offset,
+				user_buf, *copied);
+		if (ret) {
+			*copied = 0;
+			goto put;
+		}
+		*packet_offset = buf->live_offset;
+		buf->live_offset += *copied;
+		if (buf->live_offset == end) {
+			lib_ring_buffer_put_next_subbuf(buf);
+			buf->live_offset = 0;
+			*packet_end = 1;
+			return 0;
+		}
+		goto put;
+	}
+	if (ret != -EAGAIN)
+		return ret;
+
+	/* Packet under the write head. */
+	consumed = atomic_long_read(&buf->consumed);
+	end = lib_ring_buffer_committed_prefix(buf, consumed);
+	if (end <= buf->live_offset)
+		return -EAGAIN;
+	/*
+	 * In discard mode the reader uses the writer pages directly, and the
+	 * writer does not overwrite them before they are consumed.
+	 */
+	bufb->buf_rsb.id = bufb->buf_wsb[subbuf_index(consumed, buf)].id;
+	*copied = min_t(size_t, len, end - buf->live_offset);
+	ret = __lib_ring_buffer_copy_to_user(bufb, consumed + buf->live_offset,
+					     user_buf, *copied);
+	if (ret) {
+		*copied = 0;
+		return ret;
+	}
+	*packet_offset = buf->live_offset;
+	buf->live_offset += *copied;
+	buf->live_header_stale = 1;
+	return 0;
+
+put:
+	lib_ring_buffer_put_subbuf(buf);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_live_read);
+
 /*
  * cons_offset is an iterator on all subbuffer offsets between the reader
  * position and the writer position. (inclusive)
@@ -1377,7 +2825,7 @@ void lib_ring_buffer_print_subbuffer_errors(struct lib_ring_buffer *buf,
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 	unsigned long cons_idx, commit_count, commit_count_sb;
 
-	cons_idx = subbuf_index(cons_offset, chan);
+	cons_idx = subbuf_index(cons_offset, buf);
 	commit_count = v_read(config, &buf->commit_hot[cons_idx].cc);
 	commit_count_sb = v_read(config, &buf->commit_cold[cons_idx].cc_sb);
 
@@ -1448,15 +2896,25 @@ void lib_ring_buffer_print_errors(struct channel *chan,
 
 		if (v_read(config, &buf->records_lost_full)
 		    || v_read(config, &buf->records_lost_wrap)
-		    || v_read(config, &buf->records_lost_big))
+		    || v_read(config, &buf->records_lost_big)
+		    || v_read(config, &buf->records_lost_prio)
+		    || v_read(config, &buf->records_lost_alloc)
+		    || v_read(config, &buf->records_lost_resize))
 			printk(KERN_WARNING
 				"ring buffer %s, cpu %d: records were lost. Caused by:\n"
-				"  [ %lu buffer full, %lu nest buffer wrap-around, "
-				"%lu event too big ]\n",
+				"  [ %lu buffer full (%lu high priority), "
+				"%lu nest buffer wrap-around, "
+				"%lu event too big, %lu priority watermark, "
+				"%lu buffer not allocated yet, "
+				"%lu buffer being resized ]\n",
 				chan->backend.name, cpu,
 				v_read(config, &buf->records_lost_full),
+				v_read(config, &buf->records_lost_full_high),
 				v_read(config, &buf->records_lost_wrap),
-				v_read(config, &buf->records_lost_big));
+				v_read(config, &buf->records_lost_big),
+				v_read(config, &buf->records_lost_prio),
+				v_read(config, &buf->records_lost_alloc),
+				v_read(config, &buf->records_lost_resize));
 	}
 	lib_ring_buffer_print_buffer_errors(buf, chan, priv, cpu);
 }
@@ -1474,7 +2932,7 @@ void lib_ring_buffer_switch_old_start(struct lib_ring_buffer *buf,
 				      u64 tsc)
 {
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	unsigned long oldidx = subbuf_index(offsets->old, chan);
+	unsigned long oldidx = subbuf_index(offsets->old, buf);
 	unsigned long commit_count;
 	struct commit_counters_hot *cc_hot;
 
@@ -1519,7 +2977,7 @@ void lib_ring_buffer_switch_old_end(struct lib_ring_buffer *buf,
 				    u64 tsc)
 {
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	unsigned long oldidx = subbuf_index(offsets->old - 1, chan);
+	unsigned long oldidx = subbuf_index(offsets->old - 1, buf);
 	unsigned long commit_count, padding_size, data_size;
 	struct commit_counters_hot *cc_hot;
 
@@ -1564,7 +3022,7 @@ void lib_ring_buffer_switch_new_start(struct lib_ring_buffer *buf,
 				      u64 tsc)
 {
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	unsigned long beginidx = subbuf_index(offsets->begin, chan);
+	unsigned long beginidx = subbuf_index(offsets->begin, buf);
 	unsigned long commit_count;
 	struct commit_counters_hot *cc_hot;
 
@@ -1611,7 +3069,7 @@ void lib_ring_buffer_switch_new_end(struct lib_ring_buffer *buf,
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
 	unsigned long endidx, data_size;
 
-	endidx = subbuf_index(offsets->end - 1, chan);
+	endidx = subbuf_index(offsets->end - 1, buf);
 	data_size = subbuf_offset(offsets->end - 1, chan) + 1;
 	subbuffer_set_data_size(config, &buf->backend, endidx, data_size);
 }
@@ -1674,20 +3132,20 @@ int lib_ring_buffer_try_switch_slow(enum switch_mode mode,
 			return -1;
 
 		/* Test new buffer integrity */
-		sb_index = subbuf_index(offsets->begin, chan);
+		sb_index = subbuf_index(offsets->begin, buf);
 		commit_count = v_read(config,
 				&buf->commit_cold[sb_index].cc_sb);
 		reserve_commit_diff =
-		  (buf_trunc(offsets->begin, chan)
-		   >> chan->backend.num_subbuf_order)
-		  - (commit_count & chan->commit_count_mask);
+		  (buf_trunc(offsets->begin, buf)
+		   >> buf->backend.num_subbuf_order)
+		  - (commit_count & buf->commit_count_mask);
 		if (likely(reserve_commit_diff == 0)) {
 			/* Next subbuffer not being written to. */
 			if (unlikely(config->mode != RING_BUFFER_OVERWRITE &&
 				subbuf_trunc(offsets->begin, chan)
 				 - subbuf_trunc((unsigned long)
 				     atomic_long_read(&buf->consumed), chan)
-				>= chan->backend.buf_size)) {
+				>= buf->backend.buf_size)) {
 				/*
 				 * We do not overwrite non consumed buffers
 				 * and we are full : don't switch.
@@ -1764,7 +3222,7 @@ void lib_ring_buffer_switch_slow(struct lib_ring_buffer *buf, enum switch_mode m
 	 */
 	lib_ring_buffer_reserve_push_reader(buf, chan, offsets.old);
 
-	oldidx = subbuf_index(offsets.old, chan);
+	oldidx = subbuf_index(offsets.old, buf);
 	lib_ring_buffer_clear_noref(config, &buf->backend, oldidx);
 
 	/*
@@ -1846,6 +3304,79 @@ void lib_ring_buffer_switch_remote_empty(struct lib_ring_buffer *buf)
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_switch_remote_empty);
 
+/*
+ * Writer-side counterpart of lib_ring_buffer_consumer_page_put(): when the
+ * buffer looks full, take into account the position published by the
+ * consumer. Only the consumed count is moved here (no wakeup, so it is safe
+ * from any tracing context), and never past a sub-buffer the reader holds:
+ * those are released by the reader on its next get.
+ * Returns 1 if the consumed count moved forward.
+ */
+static
+int lib_ring_buffer_consumer_page_sync(struct lib_ring_buffer *buf,
+				       struct channel *chan)
+{
+	unsigned long consumed_old, consumed_new;
+
+	if (lib_ring_buffer_consumer_page_read(buf, chan,
+			atomic_long_read(&buf->consumer_page_limit),
+			&consumed_new))
+		return 0;
+	consumed_old = atomic_long_read(&buf->consumed);
+	if ((long) (consumed_new - consumed_old) <= 0)
+		return 0;
+	/*
+	 * The cmpxchg full barrier orders the consumer page read before the
+	 * writes to the freed sub-buffers.
+	 */
+	return atomic_long_cmpxchg(&buf->consumed, consumed_old,
+				   consumed_new) == consumed_old;
+}
+
+/*
+ * Discard mode: the writer moving into a new sub-buffer re-evaluates the
+ * priority watermark, so lib_ring_buffer_reserve() only reads the consumed
+ * count while the buffer is under pressure.
+ */
+static
+void lib_ring_buffer_update_prio_pressure(struct lib_ring_buffer *buf,
+					  struct channel *chan,
+					  unsigned long begin)
+{
+	unsigned long watermark = ACCESS_ONCE(chan->prio_watermark);
+	int pressure = 0;
+
+	if (unlikely(watermark))
+		pressure = subbuf_trunc(begin, chan)
+			   - subbuf_trunc((unsigned long)
+				atomic_long_read(&buf->consumed), chan)
+			   >= watermark;
+	if (unlikely(ACCESS_ONCE(buf->prio_pressure) != pressure))
+		ACCESS_ONCE(buf->prio_pressure) = pressure;
+}
+
+/*
+ * Discard mode: the buffer is full. Let probes drop records early until the
+ * reader frees space. The consumed count is checked again after setting the
+ * hint, so a reader moving it concurrently either sees the hint and clears
+ * it, or is seen here. Pairs with lib_ring_buffer_move_consumer().
+ */
+static
+void lib_ring_buffer_set_full_hint(struct lib_ring_buffer *buf,
+				   struct channel *chan,
+				   unsigned long begin)
+{
+	if (ACCESS_ONCE(buf->consumer_page) || ACCESS_ONCE(buf->full_hint))
+		return;
+	ACCESS_ONCE(buf->full_hint) = 1;
+	smp_mb();
+	if (subbuf_trunc(begin, chan)
+	    - subbuf_trunc((unsigned long)
+		atomic_long_read(&buf->consumed), chan)
+	    < buf->backend.buf_size)
+		ACCESS_ONCE(buf->full_hint) = 0;
+}
+
 /*
  * Returns :
  * 0 if ok
@@ -1905,7 +3436,7 @@ retry:
 		offsets->begin = offsets->begin
 				 + config->cb.subbuffer_header_size();
 		/* Test new buffer integrity */
-		sb_index = subbuf_index(offsets->begin, chan);
+		sb_index = subbuf_index(offsets->begin, buf);
 		/*
 		 * Read buf->offset before buf->commit_cold[sb_index].cc_sb.
 		 * lib_ring_buffer_check_deliver() has the matching
@@ -1928,21 +3459,33 @@ retry:
 			goto retry;
 		}
 		reserve_commit_diff =
-		  (buf_trunc(offsets->begin, chan)
-		   >> chan->backend.num_subbuf_order)
-		  - (commit_count & chan->commit_count_mask);
+		  (buf_trunc(offsets->begin, buf)
+		   >> buf->backend.num_subbuf_order)
+		  - (commit_count & buf->commit_count_mask);
 		if (likely(reserve_commit_diff == 0)) {
 			/* Next subbuffer not being written to. */
 			if (unlikely(config->mode != RING_BUFFER_OVERWRITE &&
 				subbuf_trunc(offsets->begin, chan)
 				 - subbuf_trunc((unsigned long)
 				     atomic_long_read(&buf->consumed), chan)
-				>= chan->backend.buf_size)) {
+				>= buf->backend.buf_size)) {
+				/*
+				 * The consumer may have published its position
+				 * in the consumer page.
+				 */
+				if (unlikely(ACCESS_ONCE(buf->consumer_page))
+				    && lib_ring_buffer_consumer_page_sync(buf,
+									  chan))
+					goto retry;
 				/*
 				 * We do not overwrite non consumed buffers
 				 * and we are full : record is lost.
 				 */
 				v_inc(config, &buf->records_lost_full);
+				if (ctx->rflags & RING_BUFFER_RFLAG_HIGH_PRIO)
+					v_inc(config, &buf->records_lost_full_high);
+				lib_ring_buffer_set_full_hint(buf, chan,
+							      offsets->begin);
 				return -ENOBUFS;
 			} else {
 				/*
@@ -1951,6 +3494,9 @@ retry:
 				 * not full. It's safe to write in this new
 				 * subbuffer.
 				 */
+				if (config->mode == RING_BUFFER_DISCARD)
+					lib_ring_buffer_update_prio_pressure(buf,
+						chan, offsets->begin);
 			}
 		} else {
 			/*
@@ -2010,6 +3556,8 @@ static struct lib_ring_buffer *get_current_buf(struct channel *chan, int cpu)
 
 	if (config->alloc == RING_BUFFER_ALLOC_PER_CPU)
 		return per_cpu_ptr(chan->backend.buf, cpu);
+	else if (config->alloc == RING_BUFFER_ALLOC_PER_NODE)
+		return &chan->backend.buf[cpu_to_node(cpu)];
 	else
 		return chan->backend.buf;
 }
@@ -2023,6 +3571,22 @@ void lib_ring_buffer_lost_event_too_big(struct channel *chan)
 }
 EXPORT_SYMBOL_GPL(lib_ring_buffer_lost_event_too_big);
 
+/*
+ * Account for a record dropped by its probe because the buffer full hint was
+ * set, see lib_ring_buffer_set_full_hint(). @rflags are the reservation flags
+ * the record would have been reserved with.
+ */
+void lib_ring_buffer_lost_event_full(struct channel *chan, unsigned int rflags)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer *buf = get_current_buf(chan, smp_processor_id());
+
+	v_inc(config, &buf->records_lost_full);
+	if (rflags & RING_BUFFER_RFLAG_HIGH_PRIO)
+		v_inc(config, &buf->records_lost_full_high);
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_lost_event_full);
+
 /**
  * lib_ring_buffer_reserve_slow - Atomic slot reservation in a buffer.
  * @ctx: ring buffer context.
@@ -2068,14 +3632,14 @@ int lib_ring_buffer_reserve_slow(struct lib_ring_buffer_ctx *ctx)
 	 * Clear noref flag for this subbuffer.
 	 */
 	lib_ring_buffer_clear_noref(config, &buf->backend,
-				    subbuf_index(offsets.end - 1, chan));
+				    subbuf_index(offsets.end - 1, buf));
 
 	/*
 	 * Switch old subbuffer if needed.
 	 */
 	if (unlikely(offsets.switch_old_end)) {
 		lib_ring_buffer_clear_noref(config, &buf->backend,
-					    subbuf_index(offsets.old - 1, chan));
+					    subbuf_index(offsets.old - 1, buf));
 		lib_ring_buffer_switch_old_end(buf, chan, &offsets, ctx->tsc);
 	}
 
@@ -2194,6 +3758,7 @@ void lib_ring_buffer_check_deliver_slow(const struct lib_ring_buffer_config *con
 		 * Increment the packet counter while we have exclusive
 		 * access.
 		 */
+		subbuffer_set_timestamp_end(config, &buf->backend, idx, tsc);
 		subbuffer_inc_packet_count(config, &buf->backend, idx);
 
 		/*
@@ -2202,7 +3767,7 @@ void lib_ring_buffer_check_deliver_slow(const struct lib_ring_buffer_config *con
 		 * are ordered before set noref and offset.
 		 */
 		lib_ring_buffer_set_noref_offset(config, &buf->backend, idx,
-						 buf_trunc_val(offset, chan));
+						 buf_trunc_val(offset, buf));
 
 		/*
 		 * Order set_noref and record counter updates before the
@@ -2242,13 +3807,14 @@ int __init init_lib_ring_buffer_frontend(void)
 
 	for_each_possible_cpu(cpu)
 		spin_lock_init(&per_cpu(ring_buffer_nohz_lock, cpu));
-	return 0;
+	return lib_ring_buffer_backend_init();
 }
 
 module_init(init_lib_ring_buffer_frontend);
 
 void __exit exit_lib_ring_buffer_frontend(void)
 {
+	lib_ring_buffer_backend_exit();
 }
 
 module_exit(exit_lib_ring_buffer_frontend);
@@ -24,29 +24,29 @@
 
 #include <linux/module.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 
 #include <wrapper/ringbuffer/backend.h>
 #include <wrapper/ringbuffer/frontend.h>
 #include <wrapper/ringbuffer/vfs.h>
 
 /*
- * fault() vm_op implementation for ring buffer file mapping.
+ * Map the page found at @offset within the mapping of @buf.
  */
-static int lib_ring_buffer_fault_compat(struct vm_area_struct *vma, struct vm_fault *vmf)
+static int lib_ring_buffer_fault_buf(struct lib_ring_buffer *buf,
+				     unsigned long offset,
+				     struct vm_fault *vmf)
 {
-	struct lib_ring_buffer *buf = vma->vm_private_data;
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	pgoff_t pgoff = vmf->pgoff;
 	unsigned long *pfnp;
 	void **virt;
-	unsigned long offset, sb_bindex;
+	unsigned long sb_bindex;
 
 	/*
 	 * Verify that faults are only done on the range of pages owned by the
 	 * reader.
 	 */
-	offset = pgoff << PAGE_SHIFT;
 	sb_bindex = subbuffer_id_get_index(config, buf->backend.buf_rsb.id);
 	if (!(offset >= buf->backend.array[sb_bindex]->mmap_offset
 	      && offset < buf->backend.array[sb_bindex]->mmap_offset +
@@ -65,6 +65,62 @@ static int lib_ring_buffer_fault_compat(struct vm_area_struct *vma, struct vm_fa
 	return 0;
 }
 
+/*
+ * fault() vm_op implementation for ring buffer file mapping.
+ */
+static int lib_ring_buffer_fault_compat(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct lib_ring_buffer *buf = vma->vm_private_data;
+
+	return lib_ring_buffer_fault_buf(buf, vmf->pgoff << PAGE_SHIFT, vmf);
+}
+
+/*
+ * fault() vm_op implementation for channel-wide mappings. Each buffer is
+ * mapped at (cpu * channel_get_mmap_buf_len()).
+ */
+static int channel_fault_compat(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	struct channel *chan = vma->vm_private_data;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+	unsigned long buf_len = channel_get_mmap_buf_len(chan);
+	unsigned long cpu = offset / buf_len;
+	struct lib_ring_buffer *buf;
+
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL) {
+		if (cpu != 0)
+			return VM_FAULT_SIGBUS;
+		buf = chan->backend.buf;
+	} else {
+		if (cpu >= nr_cpu_ids
+		    || !cpumask_test_cpu(cpu, chan->backend.cpumask))
+			return VM_FAULT_SIGBUS;
+		/* Order cpumask read before buffer data, see lib_ring_buffer_create. */
+		smp_rmb();
+		buf = channel_get_ring_buffer(config, chan, cpu);
+	}
+	return lib_ring_buffer_fault_buf(buf, offset - cpu * buf_len, vmf);
+}
+
+/*
+ * fault() vm_op implementation for the consumer position page mapping.
+ */
+static int lib_ring_buffer_consumer_page_fault_compat(struct vm_area_struct *vma,
+						      struct vm_fault *vmf)
+{
+	struct lib_ring_buffer *buf = vma->vm_private_data;
+	struct page *page;
+
+	if (vmf->pgoff != vma->vm_pgoff)
+		return VM_FAULT_SIGBUS;
+	page = virt_to_page(buf->consumer_page);
+	get_page(page);
+	vmf->page = page;
+
+	return 0;
+}
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
 static int lib_ring_buffer_fault(struct vm_fault *vmf)
 {
@@ -78,6 +134,33 @@ static int lib_ring_buffer_fault(struct vm_area_struct *vma, struct vm_fault *vm
 }
 #endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
+static int channel_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	return channel_fault_compat(vma, vmf);
+}
+#else /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+static int channel_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	return channel_fault_compat(vma, vmf);
+}
+#endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0))
+static int lib_ring_buffer_consumer_page_fault(struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	return lib_ring_buffer_consumer_page_fault_compat(vma, vmf);
+}
+#else /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+static int lib_ring_buffer_consumer_page_fault(struct vm_area_struct *vma,
+					       struct vm_fault *vmf)
+{
+	return lib_ring_buffer_consumer_page_fault_compat(vma, vmf);
+}
+#endif /* #else #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)) */
+
 /*
  * vm_ops for ring buffer file mappings.
  */
@@ -85,6 +168,20 @@ static const struct vm_operations_struct lib_ring_buffer_mmap_ops = {
 	.fault = lib_ring_buffer_fault,
 };
 
+/*
+ * vm_ops for consumer position page mappings.
+ */
+static const struct vm_operations_struct lib_ring_buffer_consumer_page_mmap_ops = {
+	.fault = lib_ring_buffer_consumer_page_fault,
+};
+
+/*
+ * vm_ops for channel-wide mappings.
+ */
+static const struct vm_operations_struct channel_mmap_ops = {
+	.fault = channel_fault,
+};
+
 /**
  *	lib_ring_buffer_mmap_buf: - mmap channel buffer to process address space
  *	@buf: ring buffer to map
@@ -100,16 +197,33 @@ static int lib_ring_buffer_mmap_buf(struct lib_ring_buffer *buf,
 	unsigned long length = vma->vm_end - vma->vm_start;
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
-	unsigned long mmap_buf_len;
+
+	/*
+	 * The consumer position page is mapped right after the buffer, see
+	 * RING_BUFFER_ENABLE_CONSUMER_PAGE.
+	 */
+	if (buf->consumer_page && vma->vm_pgoff
+			== channel_get_mmap_buf_len(chan) >> PAGE_SHIFT) {
+		if (length != PAGE_SIZE)
+			return -EINVAL;
+		vma->vm_ops = &lib_ring_buffer_consumer_page_mmap_ops;
+		vma->vm_flags |= VM_DONTEXPAND;
+		vma->vm_private_data = buf;
+		return 0;
+	}
+
+	/*
+	 * The packet index ring is mapped one page after the consumer
+	 * position page, see RING_BUFFER_ENABLE_PACKET_INDEX.
+	 */
+	if (buf->packet_index && vma->vm_pgoff
+			== (channel_get_mmap_buf_len(chan) + PAGE_SIZE) >> PAGE_SHIFT)
+		return remap_vmalloc_range(vma, buf->packet_index, 0);
 
 	if (config->output != RING_BUFFER_MMAP)
 		return -EINVAL;
 
-	mmap_buf_len = chan->backend.buf_size;
-	if (chan->backend.extra_reader_sb)
-		mmap_buf_len += chan->backend.subbuf_size;
-
-	if (length != mmap_buf_len)
+	if (length != channel_get_mmap_buf_len(chan))
 		return -EINVAL;
 
 	vma->vm_ops = &lib_ring_buffer_mmap_ops;
@@ -139,3 +253,40 @@ int vfs_lib_ring_buffer_mmap(struct file *filp, struct vm_area_struct *vma)
 	return lib_ring_buffer_mmap(filp, vma, buf);
 }
 EXPORT_SYMBOL_GPL(vfs_lib_ring_buffer_mmap);
+
+/**
+ *	channel_mmap - map all channel buffers in a single vma
+ *	@chan: the channel
+ *	@vma: the vma describing what to map
+ *
+ *	The buffer of cpu N is mapped at offset N * channel_get_mmap_buf_len()
+ *	(a global buffer at offset 0), with the same layout and reader
+ *	sub-buffer restrictions as the mapping of a single buffer. Slots of
+ *	cpus without buffer are left unmapped.
+ *
+ *	Returns 0 if ok, negative on error
+ */
+int channel_mmap(struct channel *chan, struct vm_area_struct *vma)
+{
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long length = vma->vm_end - vma->vm_start;
+	unsigned long nr_slots;
+
+	if (config->output != RING_BUFFER_MMAP)
+		return -EINVAL;
+
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL)
+		nr_slots = 1;
+	else
+		nr_slots = nr_cpu_ids;
+	if (vma->vm_pgoff
+	    || length != nr_slots * channel_get_mmap_buf_len(chan))
+		return -EINVAL;
+
+	vma->vm_ops = &channel_mmap_ops;
+	vma->vm_flags |= VM_DONTEXPAND;
+	vma->vm_private_data = chan;
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(channel_mmap);
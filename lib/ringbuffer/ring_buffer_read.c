@@ -0,0 +1,131 @@
+/*
+ * ring_buffer_read.c
+ *
+ * Ring buffer read() output: copy whole packets to user-space.
+ *
+ * Copyright (C) 2010-2012 Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/wait.h>
+
+#include <wrapper/ringbuffer/backend.h>
+#include <wrapper/ringbuffer/frontend.h>
+#include <wrapper/ringbuffer/vfs.h>
+
+/*
+ * Whether the reader has something to do: a sub-buffer to consume, or the
+ * end of a finalized buffer.
+ */
+static
+int lib_ring_buffer_read_ready(const struct lib_ring_buffer_config *config,
+			       struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+
+	if (lib_ring_buffer_is_finalized(config, buf)
+	    || lib_ring_buffer_channel_is_disabled(chan))
+		return 1;
+	return subbuf_trunc(lib_ring_buffer_get_offset(config, buf), chan)
+		- subbuf_trunc(lib_ring_buffer_get_consumed(config, buf), chan)
+		!= 0;
+}
+
+/**
+ *	lib_ring_buffer_packet_read - read whole packets
+ *	@filp: the file
+ *	@user_buf: user buffer to copy the packets into
+ *	@count: size of @user_buf, at least the sub-buffer size
+ *	@buf: ring buffer
+ *
+ *	Copies as many complete ready packets as fit in @user_buf, each one
+ *	with its padding up to its page-aligned packet size, and consumes them.
+ *	The sub-buffers are taken and released internally: the reader must not
+ *	hold one. Blocks until a packet is ready, unless the file is
+ *	non-blocking. Returns the number of bytes read, 0 at the end of a
+ *	finalized buffer, or a negative error value.
+ */
+ssize_t lib_ring_buffer_packet_read(struct file *filp, char __user *user_buf,
+				    size_t count, struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	unsigned long packet_size;
+	ssize_t read = 0;
+	int ret;
+
+	if (config->output != RING_BUFFER_READ)
+		return -EINVAL;
+	if (count < chan->backend.subbuf_size)
+		return -EINVAL;
+	if (buf->get_subbuf)
+		return -EBUSY;
+	if (!access_ok(VERIFY_WRITE, user_buf, count))
+		return -EFAULT;
+
+retry:
+	while (!(ret = lib_ring_buffer_get_next_subbuf(buf))) {
+		packet_size = PAGE_ALIGN(lib_ring_buffer_get_read_data_size(config,
+								buf));
+		if (packet_size > count - read) {
+			/* Keep the packet for the next read. */
+			lib_ring_buffer_put_subbuf(buf);
+			break;
+		}
+		ret = __lib_ring_buffer_copy_to_user(&buf->backend,
+				buf->cons_snapshot, user_buf + read,
+				packet_size);
+		if (ret) {
+			lib_ring_buffer_put_subbuf(buf);
+			break;
+		}
+		lib_ring_buffer_put_next_subbuf(buf);
+		read += packet_size;
+	}
+
+	if (read)
+		return read;
+	switch (ret) {
+	case -EAGAIN:
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(buf->read_wait,
+				lib_ring_buffer_read_ready(config, buf));
+		if (ret)
+			return ret;
+		if (lib_ring_buffer_channel_is_disabled(chan))
+			return -EIO;
+		goto retry;
+	case -ENODATA:
+		return 0;	/* End of a finalized buffer */
+	default:
+		return ret;
+	}
+}
+EXPORT_SYMBOL_GPL(lib_ring_buffer_packet_read);
+
+ssize_t vfs_lib_ring_buffer_packet_read(struct file *filp,
+					char __user *user_buf,
+					size_t count, loff_t *ppos)
+{
+	struct lib_ring_buffer *buf = filp->private_data;
+
+	return lib_ring_buffer_packet_read(filp, user_buf, count, buf);
+}
+EXPORT_SYMBOL_GPL(vfs_lib_ring_buffer_packet_read);
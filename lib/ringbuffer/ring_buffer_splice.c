@@ -47,16 +47,43 @@ EXPORT_SYMBOL_GPL(vfs_lib_ring_buffer_no_llseek);
 
 /*
  * Release pages from the buffer so splice pipe_to_file can move them.
- * Called after the pipe has been populated with buffer pages.
+ * Called after the pipe has been populated with buffer pages. The page
+ * goes back to the buffer page pool it was accounted to.
  */
 static void lib_ring_buffer_pipe_buf_release(struct pipe_inode_info *pipe,
 					     struct pipe_buffer *pbuf)
 {
-	__free_page(pbuf->page);
+	lib_ring_buffer_page_pool_recycle(
+		(struct lib_ring_buffer_page_pool *) pbuf->private,
+		pbuf->page);
 }
 
+/*
+ * tee() duplicates the pipe buffer, private pool pointer included. Each copy
+ * is released on its own, so each one holds a reference on the pool.
+ */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,1,0))
+static bool lib_ring_buffer_pipe_buf_get(struct pipe_inode_info *pipe,
+					 struct pipe_buffer *pbuf)
+{
+	if (!generic_pipe_buf_get(pipe, pbuf))
+		return false;
+	kref_get(&((struct lib_ring_buffer_page_pool *) pbuf->private)->ref);
+	return true;
+}
+#else
+static void lib_ring_buffer_pipe_buf_get(struct pipe_inode_info *pipe,
+					 struct pipe_buffer *pbuf)
+{
+	generic_pipe_buf_get(pipe, pbuf);
+	kref_get(&((struct lib_ring_buffer_page_pool *) pbuf->private)->ref);
+}
+#endif
+
 static const struct pipe_buf_operations ring_buffer_pipe_buf_ops = {
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(5,1,0))
 	.can_merge = 0,
+#endif
 #if (LINUX_VERSION_CODE < KERNEL_VERSION(3,15,0))
 	.map = generic_pipe_buf_map,
 	.unmap = generic_pipe_buf_unmap,
@@ -64,7 +91,7 @@ static const struct pipe_buf_operations ring_buffer_pipe_buf_ops = {
 	.confirm = generic_pipe_buf_confirm,
 	.release = lib_ring_buffer_pipe_buf_release,
 	.steal = generic_pipe_buf_steal,
-	.get = generic_pipe_buf_get,
+	.get = lib_ring_buffer_pipe_buf_get,
 };
 
 /*
@@ -73,7 +100,35 @@ static const struct pipe_buf_operations ring_buffer_pipe_buf_ops = {
 static void lib_ring_buffer_page_release(struct splice_pipe_desc *spd,
 					 unsigned int i)
 {
-	__free_page(spd->pages[i]);
+	lib_ring_buffer_page_pool_recycle(
+		(struct lib_ring_buffer_page_pool *) spd->partial[i].private,
+		spd->pages[i]);
+}
+
+/*
+ * Hand @new_page to the pipe in place of the buffer page at @roffset, and
+ * return the page to splice. RING_BUFFER_STATIC buffer pages belong to the
+ * reserved region and never leave the buffer: their content is copied into
+ * @new_page, which is spliced instead.
+ */
+static struct page *lib_ring_buffer_splice_exchange_page(
+		const struct lib_ring_buffer_config *config,
+		struct lib_ring_buffer *buf, unsigned long roffset,
+		struct page *new_page)
+{
+	unsigned long *pfnp;
+	struct page *page;
+	void **virt;
+
+	pfnp = lib_ring_buffer_read_get_pfn(&buf->backend, roffset, &virt);
+	if (config->backend == RING_BUFFER_STATIC) {
+		copy_page(page_address(new_page), *virt);
+		return new_page;
+	}
+	page = pfn_to_page(*pfnp);
+	*pfnp = page_to_pfn(new_page);
+	*virt = page_address(new_page);
+	return page;
 }
 
 /*
@@ -88,6 +143,7 @@ static int subbuf_splice_actor(struct file *in,
 {
 	struct channel *chan = buf->backend.chan;
 	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer_page_pool *pool = buf->backend.page_pool;
 	unsigned int poff, subbuf_pages, nr_pages;
 	struct page *pages[PIPE_DEF_BUFFERS];
 	struct partial_page partial[PIPE_DEF_BUFFERS];
@@ -115,7 +171,7 @@ static int subbuf_splice_actor(struct file *in,
 	 * protection.
 	 */
 	bytes_avail = chan->backend.subbuf_size;
-	WARN_ON(bytes_avail > chan->backend.buf_size);
+	WARN_ON(bytes_avail > buf->backend.buf_size);
 	len = min_t(size_t, len, bytes_avail);
 	subbuf_pages = bytes_avail >> PAGE_SHIFT;
 	nr_pages = min_t(unsigned int, subbuf_pages, PIPE_DEF_BUFFERS);
@@ -126,9 +182,7 @@ static int subbuf_splice_actor(struct file *in,
 
 	for (; spd.nr_pages < nr_pages; spd.nr_pages++) {
 		unsigned int this_len;
-		unsigned long *pfnp, new_pfn;
 		struct page *new_page;
-		void **virt;
 
 		if (!len)
 			break;
@@ -137,21 +191,19 @@ static int subbuf_splice_actor(struct file *in,
 
 		/*
 		 * We have to replace the page we are moving into the splice
-		 * pipe.
+		 * pipe. The moved page holds a reference on the page pool
+		 * until the pipe releases it.
 		 */
-		new_page = alloc_pages_node(cpu_to_node(max(buf->backend.cpu,
-							    0)),
-					    GFP_KERNEL | __GFP_ZERO, 0);
+		new_page = lib_ring_buffer_page_pool_alloc(pool);
 		if (!new_page)
 			break;
-		new_pfn = page_to_pfn(new_page);
+		kref_get(&pool->ref);
 		this_len = PAGE_SIZE - poff;
-		pfnp = lib_ring_buffer_read_get_pfn(&buf->backend, roffset, &virt);
-		spd.pages[spd.nr_pages] = pfn_to_page(*pfnp);
-		*pfnp = new_pfn;
-		*virt = page_address(new_page);
+		spd.pages[spd.nr_pages] = lib_ring_buffer_splice_exchange_page(
+				config, buf, roffset, new_page);
 		spd.partial[spd.nr_pages].offset = poff;
 		spd.partial[spd.nr_pages].len = this_len;
+		spd.partial[spd.nr_pages].private = (unsigned long) pool;
 
 		poff = 0;
 		roffset += PAGE_SIZE;
@@ -164,6 +216,205 @@ static int subbuf_splice_actor(struct file *in,
 	return wrapper_splice_to_pipe(pipe, &spd);
 }
 
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,9,0))
+/*
+ * Pages of a packet handed to splice_to_pipe() are given back by
+ * subbufs_splice_actor() itself when the pipe rejects them.
+ */
+static void lib_ring_buffer_page_keep(struct splice_pipe_desc *spd,
+				      unsigned int i)
+{
+}
+
+/*
+ * Put back into the buffer the packet page @page the pipe rejected, in place
+ * of its replacement. RING_BUFFER_STATIC buffer pages never left the buffer,
+ * only their copy has to be given back.
+ */
+static void lib_ring_buffer_splice_restore_page(
+		const struct lib_ring_buffer_config *config,
+		struct lib_ring_buffer *buf, unsigned long roffset,
+		struct page *page)
+{
+	struct lib_ring_buffer_page_pool *pool = buf->backend.page_pool;
+	unsigned long *pfnp;
+	struct page *new_page;
+	void **virt;
+
+	if (config->backend == RING_BUFFER_STATIC) {
+		lib_ring_buffer_page_pool_recycle(pool, page);
+		return;
+	}
+	pfnp = lib_ring_buffer_read_get_pfn(&buf->backend, roffset, &virt);
+	new_page = pfn_to_page(*pfnp);
+	*pfnp = page_to_pfn(page);
+	*virt = page_address(page);
+	lib_ring_buffer_page_pool_recycle(pool, new_page);
+}
+
+/*
+ * Number of free slots in @pipe. splice_read is called with the pipe locked,
+ * so they stay free until splice_to_pipe() fills them.
+ */
+static unsigned int lib_ring_buffer_pipe_free_bufs(struct pipe_inode_info *pipe)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0))
+	return pipe->max_usage - pipe_occupancy(pipe->head, pipe->tail);
+#else
+	return pipe->buffers - pipe->nrbufs;
+#endif
+}
+
+/*
+ *	subbufs_splice_actor - splice consecutive ready sub-buffers
+ *
+ * Moves as many consecutive ready sub-buffers as fit in @len and in the free
+ * slots of @pipe, each one up to its page-aligned data size, so the pipe
+ * receives a sequence of complete packets. The reader must not hold a
+ * sub-buffer: each one is taken and handed to the pipe while held, and the
+ * consumed position is moved past the packets handed over. The pipe is
+ * locked from the free slots check on, so it takes a whole packet or, if it
+ * has no reader any more, none: such a packet is put back into the buffer.
+ *
+ * Only built from 4.9: before, splice_to_pipe() takes the pipe lock itself,
+ * and another writer could fill the pipe between the check and the move.
+ *
+ * Returns the number of bytes spliced, or the error which stopped the first
+ * packet (-EAGAIN if there is no data or no room in the pipe, -ENODATA on a
+ * finalized and empty buffer).
+ */
+static ssize_t subbufs_splice_actor(struct pipe_inode_info *pipe,
+				    size_t len,
+				    unsigned int flags,
+				    struct lib_ring_buffer *buf)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	struct lib_ring_buffer_page_pool *pool = buf->backend.page_pool;
+	struct page *pages_def[PIPE_DEF_BUFFERS];
+	struct partial_page partial_def[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages_def,
+		.nr_pages = 0,
+		.partial = partial_def,
+		.flags = flags,
+		.ops = &ring_buffer_pipe_buf_ops,
+		.spd_release = lib_ring_buffer_page_keep,
+	};
+	unsigned long consumed, consumed_old, produced, roffset;
+	unsigned int max_pages, subbuf_pages, moved, i;
+	ssize_t ret, spliced = 0;
+
+	if (buf->get_subbuf)
+		return -EBUSY;
+	max_pages = chan->backend.subbuf_size >> PAGE_SHIFT;
+	if (max_pages > PIPE_DEF_BUFFERS) {
+		spd.pages = kmalloc_array(max_pages, sizeof(*spd.pages),
+					  GFP_KERNEL);
+		spd.partial = kmalloc_array(max_pages, sizeof(*spd.partial),
+					    GFP_KERNEL);
+		if (!spd.pages || !spd.partial) {
+			ret = -ENOMEM;
+			goto end;
+		}
+	}
+
+	ret = lib_ring_buffer_snapshot(buf, &consumed, &produced);
+	if (ret)
+		goto end;
+	consumed_old = consumed;
+
+	for (;;) {
+		ret = lib_ring_buffer_get_subbuf(buf, consumed);
+		if (ret)
+			break;
+		subbuf_pages = PAGE_ALIGN(lib_ring_buffer_get_read_data_size(
+						config, buf)) >> PAGE_SHIFT;
+		if (subbuf_pages > ((len - spliced) >> PAGE_SHIFT)
+		    || subbuf_pages > lib_ring_buffer_pipe_free_bufs(pipe)) {
+			lib_ring_buffer_put_subbuf(buf);
+			ret = -EAGAIN;
+			break;
+		}
+		/*
+		 * Get all the replacement pages first, so a packet is either
+		 * moved entirely or left in the buffer.
+		 */
+		for (i = 0; i < subbuf_pages; i++) {
+			struct page *new_page;
+
+			new_page = lib_ring_buffer_page_pool_alloc(pool);
+			if (!new_page)
+				break;
+			kref_get(&pool->ref);
+			spd.pages[i] = new_page;
+		}
+		if (i < subbuf_pages) {
+			while (i--)
+				lib_ring_buffer_page_pool_recycle(pool,
+					spd.pages[i]);
+			lib_ring_buffer_put_subbuf(buf);
+			ret = -ENOMEM;
+			break;
+		}
+		roffset = consumed;
+		for (i = 0; i < subbuf_pages; i++) {
+			spd.pages[i] = lib_ring_buffer_splice_exchange_page(
+					config, buf, roffset, spd.pages[i]);
+			/* Keep the page until we know whether the pipe took it. */
+			if (config->backend != RING_BUFFER_STATIC)
+				get_page(spd.pages[i]);
+			spd.partial[i].offset = 0;
+			spd.partial[i].len = PAGE_SIZE;
+			spd.partial[i].private = (unsigned long) pool;
+			roffset += PAGE_SIZE;
+		}
+		spd.nr_pages = subbuf_pages;
+		ret = wrapper_splice_to_pipe(pipe, &spd);
+		moved = ret > 0 ? ret >> PAGE_SHIFT : 0;
+		/*
+		 * Pages in the pipe cannot be taken back: a packet partly
+		 * moved, which the locked pipe rules out, is consumed
+		 * rather than spliced again.
+		 */
+		WARN_ON_ONCE(moved && moved < subbuf_pages);
+		roffset = consumed + ((unsigned long) moved << PAGE_SHIFT);
+		for (i = moved; i < subbuf_pages; i++) {
+			lib_ring_buffer_splice_restore_page(config, buf,
+					roffset, spd.pages[i]);
+			roffset += PAGE_SIZE;
+		}
+		if (config->backend != RING_BUFFER_STATIC) {
+			for (i = 0; i < subbuf_pages; i++)
+				put_page(spd.pages[i]);
+		}
+		lib_ring_buffer_put_subbuf(buf);
+		if (!moved) {
+			if (ret >= 0)
+				ret = -EAGAIN;
+			break;
+		}
+		spliced += ret;
+		consumed = subbuf_align(consumed, chan);
+		if (moved < subbuf_pages)
+			break;
+	}
+
+	printk_dbg(KERN_DEBUG "SPLICE subbufs spliced %zd consumed %lu\n",
+		   spliced, consumed);
+	if (consumed != consumed_old)
+		lib_ring_buffer_move_consumer(buf, consumed);
+	if (spliced)
+		ret = spliced;
+end:
+	if (spd.pages != pages_def) {
+		kfree(spd.pages);
+		kfree(spd.partial);
+	}
+	return ret;
+}
+#endif /* #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,9,0)) */
+
 ssize_t lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 				    struct pipe_inode_info *pipe, size_t len,
 				    unsigned int flags,
@@ -189,6 +440,13 @@ ssize_t lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 	if (*ppos != PAGE_ALIGN(*ppos) || len != PAGE_ALIGN(len))
 		return -EINVAL;
 
+	if (lib_ring_buffer_reader_slots_busy(buf))
+		return -EBUSY;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,9,0))
+	if (buf->splice_subbufs)
+		return subbufs_splice_actor(pipe, len, flags, buf);
+#endif
+
 	ret = 0;
 	spliced = 0;
 
@@ -0,0 +1,170 @@
+/*
+ * ring_buffer_static.c
+ *
+ * Static ring buffer backend memory: buffer pages taken from a region
+ * reserved at boot time rather than from the page allocator.
+ *
+ * Copyright (C) 2010-2012 Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/module.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/vmalloc.h>
+
+#include <wrapper/ringbuffer/backend.h>
+
+/*
+ * The region is either memory reserved at boot time (memblock or kernel
+ * command line reservation) covered by the kernel linear mapping, given by
+ * its physical address, whose pages must all be PageReserved(), or, when static_region_start is 0, pages allocated
+ * when the module is loaded, standing in for such a region.
+ */
+static unsigned long static_region_start;
+module_param(static_region_start, ulong, 0444);
+MODULE_PARM_DESC(static_region_start,
+	"Physical address of the memory reserved for RING_BUFFER_STATIC buffers (0: allocate at load time)");
+
+static unsigned long static_region_size;
+module_param(static_region_size, ulong, 0444);
+MODULE_PARM_DESC(static_region_size,
+	"Size of the memory reserved for RING_BUFFER_STATIC buffers, in bytes");
+
+/*
+ * Free pages of the region. Channel creation and teardown take and give
+ * back pages under static_region_mutex.
+ */
+static DEFINE_MUTEX(static_region_mutex);
+static struct page **static_region_free;
+static unsigned long static_region_nr_free;
+static unsigned long static_region_nr_pages;
+
+/**
+ * lib_ring_buffer_static_alloc_pages - take pages from the static region
+ * @pages: array of @nr_pages pages (output)
+ * @nr_pages: number of pages
+ *
+ * The pages are cleared, like pages coming from the page allocator.
+ *
+ * Returns 0 on success, -ENOMEM if the region has not enough free pages left.
+ */
+int lib_ring_buffer_static_alloc_pages(struct page **pages,
+				       unsigned long nr_pages)
+{
+	unsigned long i;
+
+	mutex_lock(&static_region_mutex);
+	if (nr_pages > static_region_nr_free) {
+		mutex_unlock(&static_region_mutex);
+		return -ENOMEM;
+	}
+	static_region_nr_free -= nr_pages;
+	memcpy(pages, &static_region_free[static_region_nr_free],
+	       nr_pages * sizeof(*pages));
+	mutex_unlock(&static_region_mutex);
+
+	for (i = 0; i < nr_pages; i++)
+		clear_page(page_address(pages[i]));
+	return 0;
+}
+
+/**
+ * lib_ring_buffer_static_free_page - give back a page to the static region
+ * @page: page taken by lib_ring_buffer_static_alloc_pages()
+ */
+void lib_ring_buffer_static_free_page(struct page *page)
+{
+	mutex_lock(&static_region_mutex);
+	WARN_ON_ONCE(static_region_nr_free >= static_region_nr_pages);
+	static_region_free[static_region_nr_free++] = page;
+	mutex_unlock(&static_region_mutex);
+}
+
+static
+void lib_ring_buffer_static_release(void)
+{
+	unsigned long i;
+
+	/* Stand-in region pages come from the page allocator. */
+	if (!static_region_start) {
+		for (i = 0; i < static_region_nr_free; i++)
+			__free_page(static_region_free[i]);
+	}
+	vfree(static_region_free);
+	static_region_free = NULL;
+	static_region_nr_free = static_region_nr_pages = 0;
+}
+
+int lib_ring_buffer_static_init(void)
+{
+	unsigned long i, nr_pages, pfn;
+	struct page *page;
+	int ret = -EINVAL;
+
+	nr_pages = static_region_size >> PAGE_SHIFT;
+	if (!nr_pages)
+		return 0;
+	if (static_region_start & ~PAGE_MASK)
+		return -EINVAL;
+	static_region_free = vmalloc(nr_pages * sizeof(*static_region_free));
+	if (!static_region_free)
+		return -ENOMEM;
+	static_region_nr_pages = nr_pages;
+
+	pfn = static_region_start >> PAGE_SHIFT;
+	for (i = 0; i < nr_pages; i++) {
+		if (static_region_start) {
+			/* Buffer pages are accessed through the linear map. */
+			if (!pfn_valid(pfn + i))
+				goto error;
+			page = pfn_to_page(pfn + i);
+			if (PageHighMem(page))
+				goto error;
+			/*
+			 * Only memory kept away from the page allocator at
+			 * boot can be handed out: anything else may already
+			 * be in use by the kernel.
+			 */
+			if (!PageReserved(page))
+				goto error;
+		} else {
+			page = alloc_page(GFP_KERNEL | __GFP_NOWARN);
+			if (!page) {
+				ret = -ENOMEM;
+				goto error;
+			}
+		}
+		static_region_free[static_region_nr_free++] = page;
+	}
+	printk(KERN_INFO "LTTng: ring buffer static region of %lu pages\n",
+	       nr_pages);
+	return 0;
+
+error:
+	printk(KERN_WARNING "LTTng: cannot set up ring buffer static region at page %lu\n",
+	       i);
+	lib_ring_buffer_static_release();
+	return ret;
+}
+
+void lib_ring_buffer_static_exit(void)
+{
+	/* All channels are gone: every page is back. */
+	WARN_ON(static_region_nr_free != static_region_nr_pages);
+	lib_ring_buffer_static_release();
+}
@@ -23,6 +23,7 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/compat.h>
+#include <linux/version.h>
 
 #include <wrapper/ringbuffer/backend.h>
 #include <wrapper/ringbuffer/frontend.h>
@@ -134,6 +135,10 @@ retry:
 		if (disabled)
 			return POLLERR;
 
+		/* Install the memory posted by channel_resize(). */
+		if (ACCESS_ONCE(buf->resize))
+			return POLLIN | POLLRDNORM;
+
 		if (subbuf_trunc(lib_ring_buffer_get_offset(config, buf), chan)
 		  - subbuf_trunc(lib_ring_buffer_get_consumed(config, buf), chan)
 		  == 0) {
@@ -155,7 +160,7 @@ retry:
 					 chan)
 			  - subbuf_trunc(lib_ring_buffer_get_consumed(config, buf),
 					 chan)
-			  >= chan->backend.buf_size)
+			  >= buf->backend.buf_size)
 				return POLLPRI | POLLRDBAND;
 			else
 				return POLLIN | POLLRDNORM;
@@ -180,6 +185,104 @@ unsigned int vfs_lib_ring_buffer_poll(struct file *filp, poll_table *wait)
 	return lib_ring_buffer_poll(filp, wait, buf);
 }
 
+/*
+ * Snapshot of the packets ending at or after the timestamp at @arg.
+ */
+static
+long lib_ring_buffer_ioctl_snapshot_since(struct lib_ring_buffer *buf,
+					  unsigned long arg)
+{
+	uint64_t since;
+
+	if (copy_from_user(&since, (uint64_t __user *) arg, sizeof(since)))
+		return -EFAULT;
+	/* Flush, as for RING_BUFFER_SNAPSHOT. */
+	if (!buf->quiescent)
+		lib_ring_buffer_switch_remote_empty(buf);
+	return lib_ring_buffer_snapshot_since(buf, since, &buf->cons_snapshot,
+					      &buf->prod_snapshot);
+}
+
+/*
+ * Perform a live read described by the user-space struct at @arg.
+ */
+static
+long lib_ring_buffer_ioctl_live_read(struct lib_ring_buffer *buf,
+				     unsigned long arg)
+{
+	struct lib_ring_buffer_live_read __user *ulive =
+		(struct lib_ring_buffer_live_read __user *) arg;
+	struct lib_ring_buffer_live_read live;
+	unsigned long packet_offset;
+	size_t copied;
+	int packet_end;
+	long ret;
+
+	if (copy_from_user(&live, ulive, sizeof(live)))
+		return -EFAULT;
+	ret = lib_ring_buffer_live_read(buf,
+			(char __user *) (unsigned long) live.buf,
+			live.len, &packet_offset, &copied, &packet_end);
+	if (ret)
+		return ret;
+	live.packet_offset = packet_offset;
+	live.copied = copied;
+	live.packet_end = packet_end;
+	if (copy_to_user(ulive, &live, sizeof(live)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Enable the packet index ring, and describe it in the user-space struct at
+ * @arg.
+ */
+static
+long lib_ring_buffer_ioctl_enable_packet_index(struct lib_ring_buffer *buf,
+					       unsigned long arg)
+{
+	struct channel *chan = buf->backend.chan;
+	struct lib_ring_buffer_packet_index_info info;
+	long ret;
+
+	ret = lib_ring_buffer_enable_packet_index(buf);
+	if (ret)
+		return ret;
+	memset(&info, 0, sizeof(info));
+	info.mmap_offset = channel_get_mmap_buf_len(chan) + PAGE_SIZE;
+	info.mmap_len = PAGE_ALIGN(buf->packet_index_len
+			* sizeof(struct lib_ring_buffer_packet_index));
+	info.nr_entries = buf->packet_index_len;
+	info.entry_size = sizeof(struct lib_ring_buffer_packet_index);
+	if (copy_to_user((void __user *) arg, &info, sizeof(info)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Read packet index entries as described by the user-space struct at @arg.
+ */
+static
+long lib_ring_buffer_ioctl_read_packet_index(struct lib_ring_buffer *buf,
+					     unsigned long arg)
+{
+	struct lib_ring_buffer_packet_index_read __user *uread =
+		(struct lib_ring_buffer_packet_index_read __user *) arg;
+	struct lib_ring_buffer_packet_index_read read;
+	unsigned int nr_read;
+	long ret;
+
+	if (copy_from_user(&read, uread, sizeof(read)))
+		return -EFAULT;
+	ret = lib_ring_buffer_read_packet_index(buf,
+			(struct lib_ring_buffer_packet_index __user *)
+				(unsigned long) read.entries,
+			read.count, &nr_read);
+	if (ret)
+		return ret;
+	return put_user(nr_read, &uread->count);
+}
+
 long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 		unsigned long arg, struct lib_ring_buffer *buf)
 {
@@ -202,6 +305,8 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 			lib_ring_buffer_switch_remote_empty(buf);
 		return lib_ring_buffer_snapshot(buf, &buf->cons_snapshot,
 					    &buf->prod_snapshot);
+	case RING_BUFFER_SNAPSHOT_SINCE:
+		return lib_ring_buffer_ioctl_snapshot_since(buf, arg);
 	case RING_BUFFER_SNAPSHOT_GET_CONSUMED:
 		return put_ulong(buf->cons_snapshot, arg);
 	case RING_BUFFER_SNAPSHOT_GET_PRODUCED:
@@ -211,6 +316,8 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 		unsigned long uconsume;
 		long ret;
 
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		ret = get_user(uconsume, (unsigned long __user *) arg);
 		if (ret)
 			return ret; /* will return -EFAULT */
@@ -222,6 +329,8 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 		return ret;
 	}
 	case RING_BUFFER_PUT_SUBBUF:
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		lib_ring_buffer_put_subbuf(buf);
 		return 0;
 
@@ -229,6 +338,8 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 	{
 		long ret;
 
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		ret = lib_ring_buffer_get_next_subbuf(buf);
 		if (!ret) {
 			/* Set file position to zero at each successful "get" */
@@ -237,6 +348,8 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 		return ret;
 	}
 	case RING_BUFFER_PUT_NEXT_SUBBUF:
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		lib_ring_buffer_put_next_subbuf(buf);
 		return 0;
 	case RING_BUFFER_GET_SUBBUF_SIZE:
@@ -258,9 +371,7 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 
 		if (config->output != RING_BUFFER_MMAP)
 			return -EINVAL;
-		mmap_buf_len = chan->backend.buf_size;
-		if (chan->backend.extra_reader_sb)
-			mmap_buf_len += chan->backend.subbuf_size;
+		mmap_buf_len = channel_get_mmap_buf_len(chan);
 		if (mmap_buf_len > INT_MAX)
 			return -EFBIG;
 		return put_ulong(mmap_buf_len, arg);
@@ -279,6 +390,81 @@ long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
 	case RING_BUFFER_FLUSH:
 		lib_ring_buffer_switch_remote(buf);
 		return 0;
+	case RING_BUFFER_ENABLE_CONSUMER_PAGE:
+	{
+		long ret;
+
+		ret = lib_ring_buffer_enable_consumer_page(buf);
+		if (ret)
+			return ret;
+		return put_ulong(channel_get_mmap_buf_len(chan), arg);
+	}
+	case RING_BUFFER_GET_NEXT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = lib_ring_buffer_get_next_subbuf_slot(buf, &slot);
+		if (ret)
+			return ret;
+		/* Set file position to zero at each successful "get" */
+		filp->f_pos = 0;
+		return put_user(slot, (uint32_t __user *) arg);
+	}
+	case RING_BUFFER_SELECT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = get_user(slot, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		return lib_ring_buffer_select_subbuf_slot(buf, slot);
+	}
+	case RING_BUFFER_PUT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = get_user(slot, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		return lib_ring_buffer_put_subbuf_slot(buf, slot);
+	}
+	case RING_BUFFER_SET_SPLICE_SUBBUFS:
+	{
+		uint32_t enable;
+		long ret;
+
+		if (config->output != RING_BUFFER_SPLICE)
+			return -EINVAL;
+		/* A packet could be split across pipe writers, see splice. */
+		if (LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0))
+			return -ENOSYS;
+		ret = get_user(enable, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		buf->splice_subbufs = !!enable;
+		return 0;
+	}
+	case RING_BUFFER_LIVE_READ:
+		return lib_ring_buffer_ioctl_live_read(buf, arg);
+	case RING_BUFFER_ENABLE_PACKET_INDEX:
+		return lib_ring_buffer_ioctl_enable_packet_index(buf, arg);
+	case RING_BUFFER_READ_PACKET_INDEX:
+		return lib_ring_buffer_ioctl_read_packet_index(buf, arg);
+	case RING_BUFFER_GET_SUBBUF_SLOTS:
+	{
+		uint32_t count;
+		long ret;
+
+		ret = lib_ring_buffer_get_subbuf_slots(buf, &count);
+		if (ret)
+			return ret;
+		/* Set file position to zero at each successful "get" */
+		filp->f_pos = 0;
+		return put_user(count, (uint32_t __user *) arg);
+	}
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -308,6 +494,26 @@ EXPORT_SYMBOL_GPL(lib_ring_buffer_ioctl);
  *      RING_BUFFER_GET_MMAP_READ_OFFSET
  *              returns the offset of the subbuffer belonging to the reader.
  *              Should only be used for mmap clients.
+ *	RING_BUFFER_ENABLE_CONSUMER_PAGE
+ *		enables the consumer position page, returns its mmap offset.
+ *	RING_BUFFER_GET_NEXT_SUBBUF_SLOT
+ *		Get the next sub-buffer into a free reader slot, return the slot.
+ *	RING_BUFFER_SELECT_SUBBUF_SLOT
+ *		Select the reader slot the sub-buffer commands apply to.
+ *	RING_BUFFER_PUT_SUBBUF_SLOT
+ *		Release a reader slot, move consumer forward.
+ *	RING_BUFFER_SET_SPLICE_SUBBUFS
+ *		Let splice() move several whole sub-buffers per call.
+ *	RING_BUFFER_LIVE_READ
+ *		Copy the committed data of the packet being written.
+ *	RING_BUFFER_ENABLE_PACKET_INDEX
+ *		Enable the packet index ring, return its mmap offset and size.
+ *	RING_BUFFER_READ_PACKET_INDEX
+ *		Copy the packet index entries not read yet.
+ *	RING_BUFFER_GET_SUBBUF_SLOTS
+ *		Get readable sub-buffers into the reader slots, return their count.
+ *	RING_BUFFER_SNAPSHOT_SINCE
+ *		Snapshot restricted to the packets ending after a timestamp.
  */
 static
 long vfs_lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
@@ -340,6 +546,8 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 			lib_ring_buffer_switch_remote_empty(buf);
 		return lib_ring_buffer_snapshot(buf, &buf->cons_snapshot,
 						&buf->prod_snapshot);
+	case RING_BUFFER_COMPAT_SNAPSHOT_SINCE:
+		return lib_ring_buffer_ioctl_snapshot_since(buf, arg);
 	case RING_BUFFER_COMPAT_SNAPSHOT_GET_CONSUMED:
 		return compat_put_ulong(buf->cons_snapshot, arg);
 	case RING_BUFFER_COMPAT_SNAPSHOT_GET_PRODUCED:
@@ -350,6 +558,8 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 		unsigned long consume;
 		long ret;
 
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		ret = get_user(uconsume, (__u32 __user *) arg);
 		if (ret)
 			return ret; /* will return -EFAULT */
@@ -364,6 +574,8 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 		return ret;
 	}
 	case RING_BUFFER_COMPAT_PUT_SUBBUF:
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		lib_ring_buffer_put_subbuf(buf);
 		return 0;
 
@@ -371,6 +583,8 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 	{
 		long ret;
 
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		ret = lib_ring_buffer_get_next_subbuf(buf);
 		if (!ret) {
 			/* Set file position to zero at each successful "get" */
@@ -379,6 +593,8 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 		return ret;
 	}
 	case RING_BUFFER_COMPAT_PUT_NEXT_SUBBUF:
+		if (lib_ring_buffer_reader_slots_busy(buf))
+			return -EBUSY;
 		lib_ring_buffer_put_next_subbuf(buf);
 		return 0;
 	case RING_BUFFER_COMPAT_GET_SUBBUF_SIZE:
@@ -410,9 +626,7 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 
 		if (config->output != RING_BUFFER_MMAP)
 			return -EINVAL;
-		mmap_buf_len = chan->backend.buf_size;
-		if (chan->backend.extra_reader_sb)
-			mmap_buf_len += chan->backend.subbuf_size;
+		mmap_buf_len = channel_get_mmap_buf_len(chan);
 		if (mmap_buf_len > UINT_MAX)
 			return -EFBIG;
 		return compat_put_ulong(mmap_buf_len, arg);
@@ -433,6 +647,81 @@ long lib_ring_buffer_compat_ioctl(struct file *filp, unsigned int cmd,
 	case RING_BUFFER_COMPAT_FLUSH:
 		lib_ring_buffer_switch_remote(buf);
 		return 0;
+	case RING_BUFFER_COMPAT_ENABLE_CONSUMER_PAGE:
+	{
+		long ret;
+
+		ret = lib_ring_buffer_enable_consumer_page(buf);
+		if (ret)
+			return ret;
+		return compat_put_ulong(channel_get_mmap_buf_len(chan), arg);
+	}
+	case RING_BUFFER_COMPAT_GET_NEXT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = lib_ring_buffer_get_next_subbuf_slot(buf, &slot);
+		if (ret)
+			return ret;
+		/* Set file position to zero at each successful "get" */
+		filp->f_pos = 0;
+		return put_user(slot, (uint32_t __user *) arg);
+	}
+	case RING_BUFFER_COMPAT_SELECT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = get_user(slot, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		return lib_ring_buffer_select_subbuf_slot(buf, slot);
+	}
+	case RING_BUFFER_COMPAT_PUT_SUBBUF_SLOT:
+	{
+		uint32_t slot;
+		long ret;
+
+		ret = get_user(slot, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		return lib_ring_buffer_put_subbuf_slot(buf, slot);
+	}
+	case RING_BUFFER_COMPAT_SET_SPLICE_SUBBUFS:
+	{
+		uint32_t enable;
+		long ret;
+
+		if (config->output != RING_BUFFER_SPLICE)
+			return -EINVAL;
+		/* A packet could be split across pipe writers, see splice. */
+		if (LINUX_VERSION_CODE < KERNEL_VERSION(4,9,0))
+			return -ENOSYS;
+		ret = get_user(enable, (uint32_t __user *) arg);
+		if (ret)
+			return ret; /* will return -EFAULT */
+		buf->splice_subbufs = !!enable;
+		return 0;
+	}
+	case RING_BUFFER_COMPAT_LIVE_READ:
+		return lib_ring_buffer_ioctl_live_read(buf, arg);
+	case RING_BUFFER_COMPAT_ENABLE_PACKET_INDEX:
+		return lib_ring_buffer_ioctl_enable_packet_index(buf, arg);
+	case RING_BUFFER_COMPAT_READ_PACKET_INDEX:
+		return lib_ring_buffer_ioctl_read_packet_index(buf, arg);
+	case RING_BUFFER_COMPAT_GET_SUBBUF_SLOTS:
+	{
+		uint32_t count;
+		long ret;
+
+		ret = lib_ring_buffer_get_subbuf_slots(buf, &count);
+		if (ret)
+			return ret;
+		/* Set file position to zero at each successful "get" */
+		filp->f_pos = 0;
+		return put_user(count, (uint32_t __user *) arg);
+	}
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -455,6 +744,7 @@ const struct file_operations lib_ring_buffer_file_operations = {
 	.release = vfs_lib_ring_buffer_release,
 	.poll = vfs_lib_ring_buffer_poll,
 	.splice_read = vfs_lib_ring_buffer_splice_read,
+	.read = vfs_lib_ring_buffer_packet_read,
 	.mmap = vfs_lib_ring_buffer_mmap,
 	.unlocked_ioctl = vfs_lib_ring_buffer_ioctl,
 	.llseek = vfs_lib_ring_buffer_no_llseek,
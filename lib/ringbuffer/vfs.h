@@ -50,6 +50,12 @@ ssize_t lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 		unsigned int flags, struct lib_ring_buffer *buf);
 int lib_ring_buffer_mmap(struct file *filp, struct vm_area_struct *vma,
 		struct lib_ring_buffer *buf);
+ssize_t lib_ring_buffer_packet_read(struct file *filp, char __user *user_buf,
+		size_t count, struct lib_ring_buffer *buf);
+
+struct channel;
+
+int channel_mmap(struct channel *chan, struct vm_area_struct *vma);
 
 /* Ring Buffer ioctl() and ioctl numbers */
 long lib_ring_buffer_ioctl(struct file *filp, unsigned int cmd,
@@ -67,6 +73,8 @@ int vfs_lib_ring_buffer_mmap(struct file *filp, struct vm_area_struct *vma);
 ssize_t vfs_lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 		struct pipe_inode_info *pipe, size_t len,
 		unsigned int flags);
+ssize_t vfs_lib_ring_buffer_packet_read(struct file *filp,
+		char __user *user_buf, size_t count, loff_t *ppos);
 
 /*
  * Use RING_BUFFER_GET_NEXT_SUBBUF / RING_BUFFER_PUT_NEXT_SUBBUF to read and
@@ -115,6 +123,105 @@ ssize_t vfs_lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 #define RING_BUFFER_FLUSH			_IO(0xF6, 0x0C)
 /* Get the current version of the metadata cache (after a get_next). */
 #define RING_BUFFER_GET_METADATA_VERSION	_IOR(0xF6, 0x0D, uint64_t)
+/*
+ * Enable the consumer position page (discard mode only), and return its
+ * offset for mmap(). The page starts with a native-endian uint64_t in which
+ * the consumer publishes its consumed position (sub-buffer aligned) rather
+ * than calling RING_BUFFER_PUT_NEXT_SUBBUF. The sub-buffer held is then
+ * released by the next RING_BUFFER_GET_NEXT_SUBBUF, or by the writer when
+ * it needs the space.
+ */
+#define RING_BUFFER_ENABLE_CONSUMER_PAGE	_IOR(0xF6, 0x0E, unsigned long)
+/*
+ * Reader slots, for channels created with more than one reader sub-buffer.
+ * RING_BUFFER_GET_NEXT_SUBBUF_SLOT gets the sub-buffer following the ones
+ * already held into a free slot, selects that slot and returns its index.
+ * RING_BUFFER_SELECT_SUBBUF_SLOT selects the slot on which the other
+ * sub-buffer ioctls, read and mmap faults operate.
+ * RING_BUFFER_PUT_SUBBUF_SLOT releases a slot, in any order, and moves the
+ * consumer position up to the oldest sub-buffer still held.
+ * While a slot other than the selected one is held, the GET/PUT_SUBBUF and
+ * GET/PUT_NEXT_SUBBUF ioctls and splice fail with -EBUSY.
+ */
+#define RING_BUFFER_GET_NEXT_SUBBUF_SLOT	_IOR(0xF6, 0x0F, uint32_t)
+#define RING_BUFFER_SELECT_SUBBUF_SLOT		_IOW(0xF6, 0x10, uint32_t)
+#define RING_BUFFER_PUT_SUBBUF_SLOT		_IOW(0xF6, 0x11, uint32_t)
+/*
+ * Set (1) or clear (0) the multi sub-buffer splice mode. In this mode the
+ * reader does not get/put sub-buffers: each splice() moves as many
+ * consecutive ready packets as fit in the length and in the pipe, each one
+ * page-aligned, and moves the consumer position past them. It fails with
+ * -EAGAIN, without consuming anything, when the pipe has no room for the
+ * next whole packet, and with -ENODATA once the buffer is finalized and empty.
+ * Needs Linux 4.9 or later, fails with -ENOSYS before.
+ */
+#define RING_BUFFER_SET_SPLICE_SUBBUFS		_IOW(0xF6, 0x12, uint32_t)
+
+/*
+ * Live read (discard mode only): copy the next bytes of the packet at the
+ * consumed position, including the committed prefix of the packet still
+ * being written. The data is to be stored at packet_offset within the
+ * packet: the packet header is copied again, at offset 0, once the packet
+ * is complete. packet_end is set when the packet has been consumed.
+ */
+struct lib_ring_buffer_live_read {
+	uint64_t buf;			/* User buffer address (input) */
+	uint64_t len;			/* User buffer length (input) */
+	uint64_t packet_offset;		/* Offset within the packet (output) */
+	uint64_t copied;		/* Bytes copied (output) */
+	uint32_t packet_end;		/* Packet consumed (output) */
+	uint32_t padding;
+} __attribute__((packed));
+
+#define RING_BUFFER_LIVE_READ	\
+	_IOWR(0xF6, 0x13, struct lib_ring_buffer_live_read)
+
+/*
+ * Enable the packet index ring: an array of nr_entries struct
+ * lib_ring_buffer_packet_index, appended to as packets are delivered, the
+ * entry of packet seq_num being at index (seq_num % nr_entries). It can be
+ * mapped read-only at mmap_offset, an entry being valid while its seq_num
+ * reads the same before and after copying it, or read in bulk in packet
+ * order with RING_BUFFER_READ_PACKET_INDEX.
+ */
+struct lib_ring_buffer_packet_index_info {
+	uint64_t mmap_offset;		/* Offset for mmap() (output) */
+	uint64_t mmap_len;		/* Length to mmap() (output) */
+	uint32_t nr_entries;		/* Number of entries (output) */
+	uint32_t entry_size;		/* Size of an entry (output) */
+} __attribute__((packed));
+
+#define RING_BUFFER_ENABLE_PACKET_INDEX	\
+	_IOR(0xF6, 0x14, struct lib_ring_buffer_packet_index_info)
+
+/*
+ * Copy up to count entries following the last one read. Entries overwritten
+ * before being read are skipped. count is set to the number of entries
+ * copied.
+ */
+struct lib_ring_buffer_packet_index_read {
+	uint64_t entries;		/* User array address (input) */
+	uint32_t count;			/* Array capacity (input), entries read (output) */
+	uint32_t padding;
+} __attribute__((packed));
+
+#define RING_BUFFER_READ_PACKET_INDEX	\
+	_IOWR(0xF6, 0x15, struct lib_ring_buffer_packet_index_read)
+
+/*
+ * Overwrite mode only: get the readable sub-buffers, oldest first, into
+ * reader slots 0 to count - 1, and return count. As many as there are reader
+ * slots are got, one RING_BUFFER_GET_NEXT_SUBBUF_SLOT each. Writers go on
+ * into the spare sub-buffers of the slots, no data is copied. The slots are
+ * released with RING_BUFFER_PUT_SUBBUF_SLOT.
+ */
+#define RING_BUFFER_GET_SUBBUF_SLOTS		_IOR(0xF6, 0x16, uint32_t)
+/*
+ * Same as RING_BUFFER_SNAPSHOT, leaving out the oldest packets which end
+ * before the given timestamp (ring buffer clock, as returned by
+ * LTTNG_RING_BUFFER_GET_CURRENT_TIMESTAMP for LTTng streams).
+ */
+#define RING_BUFFER_SNAPSHOT_SINCE		_IOW(0xF6, 0x17, uint64_t)
 
 #ifdef CONFIG_COMPAT
 /* Get a snapshot of the current ring buffer producer and consumer positions */
@@ -149,6 +256,24 @@ ssize_t vfs_lib_ring_buffer_splice_read(struct file *in, loff_t *ppos,
 #define RING_BUFFER_COMPAT_FLUSH		RING_BUFFER_FLUSH
 /* Get the current version of the metadata cache (after a get_next). */
 #define RING_BUFFER_COMPAT_GET_METADATA_VERSION	RING_BUFFER_GET_METADATA_VERSION
+/* Enable the consumer position page, return its mmap offset. */
+#define RING_BUFFER_COMPAT_ENABLE_CONSUMER_PAGE	\
+	_IOR(0xF6, 0x0E, compat_ulong_t)
+/* Reader slots. */
+#define RING_BUFFER_COMPAT_GET_NEXT_SUBBUF_SLOT	RING_BUFFER_GET_NEXT_SUBBUF_SLOT
+#define RING_BUFFER_COMPAT_SELECT_SUBBUF_SLOT	RING_BUFFER_SELECT_SUBBUF_SLOT
+#define RING_BUFFER_COMPAT_PUT_SUBBUF_SLOT	RING_BUFFER_PUT_SUBBUF_SLOT
+/* Set the multi sub-buffer splice mode. */
+#define RING_BUFFER_COMPAT_SET_SPLICE_SUBBUFS	RING_BUFFER_SET_SPLICE_SUBBUFS
+/* Live read of the committed data of the current packet. */
+#define RING_BUFFER_COMPAT_LIVE_READ		RING_BUFFER_LIVE_READ
+/* Packet index ring. */
+#define RING_BUFFER_COMPAT_ENABLE_PACKET_INDEX	RING_BUFFER_ENABLE_PACKET_INDEX
+#define RING_BUFFER_COMPAT_READ_PACKET_INDEX	RING_BUFFER_READ_PACKET_INDEX
+/* Several reader slots at once. */
+#define RING_BUFFER_COMPAT_GET_SUBBUF_SLOTS	RING_BUFFER_GET_SUBBUF_SLOTS
+/* Time-window snapshot. */
+#define RING_BUFFER_COMPAT_SNAPSHOT_SINCE	RING_BUFFER_SNAPSHOT_SINCE
 #endif /* CONFIG_COMPAT */
 
 #endif /* _LIB_RING_BUFFER_VFS_H */
@@ -69,6 +69,7 @@ static const struct file_operations lttng_session_fops;
 static const struct file_operations lttng_channel_fops;
 static const struct file_operations lttng_metadata_fops;
 static const struct file_operations lttng_event_fops;
+static const struct file_operations lttng_stream_ready_fops;
 static struct file_operations lttng_stream_ring_buffer_file_operations;
 
 static int put_u64(uint64_t val, unsigned long arg);
@@ -391,6 +392,7 @@ int lttng_abi_create_channel(struct file *session_file,
 	}
 	switch (channel_type) {
 	case PER_CPU_CHANNEL:
+	case PER_NODE_CHANNEL:
 		fops = &lttng_channel_fops;
 		break;
 	case METADATA_CHANNEL:
@@ -413,6 +415,17 @@ int lttng_abi_create_channel(struct file *session_file,
 		} else if (chan_param->output == LTTNG_KERNEL_MMAP) {
 			transport_name = chan_param->overwrite ?
 				"relay-overwrite-mmap" : "relay-discard-mmap";
+		} else if (chan_param->output == LTTNG_KERNEL_READ) {
+			transport_name = chan_param->overwrite ?
+				"relay-overwrite-read" : "relay-discard-read";
+		} else {
+			return -EINVAL;
+		}
+		break;
+	case PER_NODE_CHANNEL:
+		if (chan_param->output == LTTNG_KERNEL_SPLICE) {
+			transport_name = chan_param->overwrite ?
+				"relay-overwrite-node" : "relay-discard-node";
 		} else {
 			return -EINVAL;
 		}
@@ -440,6 +453,8 @@ int lttng_abi_create_channel(struct file *session_file,
 	chan = lttng_channel_create(session, transport_name, NULL,
 				  chan_param->subbuf_size,
 				  chan_param->num_subbuf,
+				  chan_param->num_reader_subbuf,
+				  chan_param->lazy_alloc,
 				  chan_param->switch_timer_interval,
 				  chan_param->read_timer_interval,
 				  channel_type);
@@ -507,6 +522,9 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		chan_param.switch_timer_interval = old_chan_param.switch_timer_interval;
 		chan_param.read_timer_interval = old_chan_param.read_timer_interval;
 		chan_param.output = old_chan_param.output;
+		chan_param.num_reader_subbuf = 0;
+		chan_param.lazy_alloc = 0;
+		chan_param.per_node = 0;
 
 		return lttng_abi_create_channel(file, &chan_param,
 				PER_CPU_CHANNEL);
@@ -520,7 +538,8 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				sizeof(struct lttng_kernel_channel)))
 			return -EFAULT;
 		return lttng_abi_create_channel(file, &chan_param,
-				PER_CPU_CHANNEL);
+				chan_param.per_node ? PER_NODE_CHANNEL :
+					PER_CPU_CHANNEL);
 	}
 	case LTTNG_KERNEL_OLD_SESSION_START:
 	case LTTNG_KERNEL_OLD_ENABLE:
@@ -547,6 +566,9 @@ long lttng_session_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		chan_param.switch_timer_interval = old_chan_param.switch_timer_interval;
 		chan_param.read_timer_interval = old_chan_param.read_timer_interval;
 		chan_param.output = old_chan_param.output;
+		chan_param.num_reader_subbuf = 0;
+		chan_param.lazy_alloc = 0;
+		chan_param.per_node = 0;
 
 		return lttng_abi_create_channel(file, &chan_param,
 				METADATA_CHANNEL);
@@ -678,6 +700,15 @@ long lttng_metadata_ring_buffer_ioctl(struct file *filp,
 		break;
 	}
 	case RING_BUFFER_GET_SUBBUF:
+	case RING_BUFFER_GET_NEXT_SUBBUF_SLOT:
+	case RING_BUFFER_SELECT_SUBBUF_SLOT:
+	case RING_BUFFER_PUT_SUBBUF_SLOT:
+	case RING_BUFFER_SET_SPLICE_SUBBUFS:
+	case RING_BUFFER_LIVE_READ:
+	case RING_BUFFER_ENABLE_PACKET_INDEX:
+	case RING_BUFFER_READ_PACKET_INDEX:
+	case RING_BUFFER_GET_SUBBUF_SLOTS:
+	case RING_BUFFER_SNAPSHOT_SINCE:
 	{
 		/*
 		 * Random access is not allowed for metadata channel.
@@ -766,6 +797,15 @@ long lttng_metadata_ring_buffer_compat_ioctl(struct file *filp,
 		break;
 	}
 	case RING_BUFFER_GET_SUBBUF:
+	case RING_BUFFER_GET_NEXT_SUBBUF_SLOT:
+	case RING_BUFFER_SELECT_SUBBUF_SLOT:
+	case RING_BUFFER_PUT_SUBBUF_SLOT:
+	case RING_BUFFER_SET_SPLICE_SUBBUFS:
+	case RING_BUFFER_LIVE_READ:
+	case RING_BUFFER_ENABLE_PACKET_INDEX:
+	case RING_BUFFER_READ_PACKET_INDEX:
+	case RING_BUFFER_GET_SUBBUF_SLOTS:
+	case RING_BUFFER_SNAPSHOT_SINCE:
 	{
 		/*
 		 * Random access is not allowed for metadata channel.
@@ -963,6 +1003,137 @@ fd_error:
 	return ret;
 }
 
+/*
+ * Open all the streams of the channel which are not opened yet, up to the
+ * capacity of the user-space array.
+ */
+static
+long lttng_abi_open_stream_list(struct file *channel_file,
+		struct lttng_kernel_stream_list __user *ulist)
+{
+	struct lttng_channel *channel = channel_file->private_data;
+	uint32_t len, count = 0;
+	int ret;
+
+	ret = get_user(len, &ulist->count);
+	if (ret)
+		return ret;
+	while (count < len) {
+		struct lib_ring_buffer *buf;
+		int stream_fd;
+
+		buf = channel->ops->buffer_read_open(channel->chan);
+		if (!buf)
+			break;
+		stream_fd = lttng_abi_create_stream_fd(channel_file, buf,
+				&lttng_stream_ring_buffer_file_operations);
+		if (stream_fd < 0) {
+			channel->ops->buffer_read_close(buf);
+			ret = stream_fd;
+			break;
+		}
+		/*
+		 * The fd is installed: report it even if we fail to
+		 * report the following ones.
+		 */
+		if (put_user(stream_fd, &ulist->streams[count].fd)
+				|| put_user(buf->backend.cpu,
+					&ulist->streams[count].cpu)) {
+			ret = -EFAULT;
+			count++;
+			break;
+		}
+		count++;
+	}
+	if (put_user(count, &ulist->count))
+		return -EFAULT;
+	if (!count)
+		return ret ? ret : -ENOENT;
+	return 0;
+}
+
+/*
+ * Copy the per-event lost records counts, summed over the CPUs, up to the
+ * capacity of the user-space array.
+ */
+static
+long lttng_abi_channel_event_lost(struct lttng_channel *channel,
+		struct lttng_kernel_event_lost_list __user *ulist)
+{
+	local_t __percpu *event_lost = ACCESS_ONCE(channel->event_lost);
+	uint32_t len, id;
+	int ret;
+
+	if (!event_lost)
+		return -ENOENT;
+	ret = get_user(len, &ulist->count);
+	if (ret)
+		return ret;
+	for (id = 0; id < min(len, channel->event_lost_len); id++) {
+		uint64_t lost = 0;
+		int cpu;
+
+		for_each_possible_cpu(cpu)
+			lost += local_read(per_cpu_ptr(event_lost, cpu) + id);
+		if (put_user(lost, &ulist->lost[id]))
+			return -EFAULT;
+	}
+	if (put_user(channel->event_lost_len, &ulist->count))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Describe the channel-wide mapping set up by lttng_channel_mmap().
+ */
+static
+long lttng_abi_channel_mmap_layout(struct lttng_channel *channel,
+		struct lttng_kernel_channel_mmap_layout __user *ulayout)
+{
+	struct channel *chan = channel->chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	uint64_t stream_len = channel_get_mmap_buf_len(chan), mmap_len;
+	uint32_t len, nr_entries, count = 0;
+	int cpu, ret;
+
+	if (config->output != RING_BUFFER_MMAP)
+		return -EINVAL;
+	ret = get_user(len, &ulayout->count);
+	if (ret)
+		return ret;
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL)
+		nr_entries = 1;
+	else
+		nr_entries = cpumask_weight(chan->backend.cpumask);
+	if (len < nr_entries)
+		return put_user(nr_entries, &ulayout->count);
+
+	if (config->alloc == RING_BUFFER_ALLOC_GLOBAL) {
+		if (put_user(-1, &ulayout->entries[0].cpu)
+				|| put_user(0, &ulayout->entries[0].offset))
+			return -EFAULT;
+		count = 1;
+		mmap_len = stream_len;
+	} else {
+		for_each_channel_cpu(cpu, chan) {
+			/* Buffers created by cpu hotplug since the check. */
+			if (count == len)
+				break;
+			if (put_user(cpu, &ulayout->entries[count].cpu)
+					|| put_user((uint64_t) cpu * stream_len,
+						&ulayout->entries[count].offset))
+				return -EFAULT;
+			count++;
+		}
+		mmap_len = (uint64_t) nr_cpu_ids * stream_len;
+	}
+	if (put_user(mmap_len, &ulayout->len)
+			|| put_user(stream_len, &ulayout->stream_len)
+			|| put_user(count, &ulayout->count))
+		return -EFAULT;
+	return 0;
+}
+
 static
 int lttng_abi_open_metadata_stream(struct file *channel_file)
 {
@@ -1024,6 +1195,42 @@ nomem:
 	return ret;
 }
 
+static
+int lttng_abi_open_stream_ready(struct file *channel_file)
+{
+	struct lttng_channel *channel = channel_file->private_data;
+	int ready_fd, ret;
+	struct file *ready_file;
+
+	ready_fd = lttng_get_unused_fd();
+	if (ready_fd < 0) {
+		ret = ready_fd;
+		goto fd_error;
+	}
+	ready_file = anon_inode_getfile("[lttng_stream_ready]",
+					&lttng_stream_ready_fops,
+					channel, O_RDONLY);
+	if (IS_ERR(ready_file)) {
+		ret = PTR_ERR(ready_file);
+		goto file_error;
+	}
+	/* The readiness file holds a reference on the channel */
+	if (atomic_long_add_unless(&channel_file->f_count,
+		1, INT_MAX) == INT_MAX) {
+		ret = -EOVERFLOW;
+		goto refcount_error;
+	}
+	fd_install(ready_fd, ready_file);
+	return ready_fd;
+
+refcount_error:
+	fput(ready_file);
+file_error:
+	put_unused_fd(ready_fd);
+fd_error:
+	return ret;
+}
+
 static
 int lttng_abi_create_event(struct file *channel_file,
 			   struct lttng_kernel_event *event_param)
@@ -1131,6 +1338,24 @@ fd_error:
  *		Enable recording for events in this channel (weak enable)
  *	LTTNG_KERNEL_DISABLE
  *		Disable recording for events in this channel (strong disable)
+ *	LTTNG_KERNEL_STREAM_READY
+ *		Returns a channel-wide stream readiness file descriptor
+ *		or failure.
+ *	LTTNG_KERNEL_STREAM_LIST
+ *		Opens all remaining streams, returns their file descriptors
+ *	LTTNG_KERNEL_CHANNEL_MMAP_LAYOUT
+ *		Returns the per-stream offsets of the channel-wide mmap
+ *	LTTNG_KERNEL_CHANNEL_RESIZE
+ *		Changes the number of sub-buffers of the channel buffers
+ *	LTTNG_KERNEL_CHANNEL_RETENTION
+ *		Sets the maximum age of overwrite mode channel data
+ *	LTTNG_KERNEL_CHANNEL_PRIO_WATERMARK
+ *		Sets the fill level above which only high priority events
+ *		are recorded
+ *	LTTNG_KERNEL_CHANNEL_EVENT_LOST_ENABLE
+ *		Enables the per-event lost records accounting
+ *	LTTNG_KERNEL_CHANNEL_EVENT_LOST
+ *		Returns the records lost by each event of the channel
  *
  * Channel and event file descriptors also hold a reference on the session.
  */
@@ -1291,6 +1516,52 @@ old_ctx_end:
 	case LTTNG_KERNEL_SYSCALL_MASK:
 		return lttng_channel_syscall_mask(channel,
 			(struct lttng_kernel_syscall_mask __user *) arg);
+	case LTTNG_KERNEL_STREAM_READY:
+		return lttng_abi_open_stream_ready(file);
+	case LTTNG_KERNEL_STREAM_LIST:
+		return lttng_abi_open_stream_list(file,
+			(struct lttng_kernel_stream_list __user *) arg);
+	case LTTNG_KERNEL_CHANNEL_MMAP_LAYOUT:
+		return lttng_abi_channel_mmap_layout(channel,
+			(struct lttng_kernel_channel_mmap_layout __user *) arg);
+	case LTTNG_KERNEL_CHANNEL_RESIZE:
+	{
+		uint64_t num_subbuf;
+
+		if (copy_from_user(&num_subbuf, (uint64_t __user *) arg,
+				sizeof(num_subbuf)))
+			return -EFAULT;
+		return lttng_channel_resize(channel, num_subbuf);
+	}
+	case LTTNG_KERNEL_CHANNEL_RETENTION:
+	{
+		uint64_t usecs;
+
+		if (copy_from_user(&usecs, (uint64_t __user *) arg,
+				sizeof(usecs)))
+			return -EFAULT;
+		return lttng_channel_set_retention(channel, usecs);
+	}
+	case LTTNG_KERNEL_CHANNEL_PRIO_WATERMARK:
+	{
+		uint64_t watermark;
+
+		if (copy_from_user(&watermark, (uint64_t __user *) arg,
+				sizeof(watermark)))
+			return -EFAULT;
+		return lttng_channel_set_prio_watermark(channel, watermark);
+	}
+	case LTTNG_KERNEL_CHANNEL_EVENT_LOST_ENABLE:
+	{
+		uint32_t nr_events;
+
+		if (get_user(nr_events, (uint32_t __user *) arg))
+			return -EFAULT;
+		return lttng_channel_event_lost_enable(channel, nr_events);
+	}
+	case LTTNG_KERNEL_CHANNEL_EVENT_LOST:
+		return lttng_abi_channel_event_lost(channel,
+			(struct lttng_kernel_event_lost_list __user *) arg);
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -1350,6 +1621,20 @@ unsigned int lttng_channel_poll(struct file *file, poll_table *wait)
 
 }
 
+/*
+ *	lttng_channel_mmap - map all the channel streams in a single vma
+ *
+ *	@file: the file
+ *	@vma: the vma describing what to map
+ */
+static
+int lttng_channel_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct lttng_channel *channel = file->private_data;
+
+	return channel_mmap(channel->chan, vma);
+}
+
 static
 int lttng_channel_release(struct inode *inode, struct file *file)
 {
@@ -1377,6 +1662,7 @@ static const struct file_operations lttng_channel_fops = {
 	.owner = THIS_MODULE,
 	.release = lttng_channel_release,
 	.poll = lttng_channel_poll,
+	.mmap = lttng_channel_mmap,
 	.unlocked_ioctl = lttng_channel_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = lttng_channel_ioctl,
@@ -1406,6 +1692,8 @@ static const struct file_operations lttng_metadata_fops = {
  *		Enable recording for this event (weak enable)
  *	LTTNG_KERNEL_DISABLE
  *		Disable recording for this event (strong disable)
+ *	LTTNG_KERNEL_PRIORITY
+ *		Set the priority of this event
  */
 static
 long lttng_event_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
@@ -1463,6 +1751,26 @@ long lttng_event_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 
 		}
+	case LTTNG_KERNEL_PRIORITY:
+	{
+		uint32_t priority;
+
+		if (get_user(priority, (uint32_t __user *) arg))
+			return -EFAULT;
+		if (priority > LTTNG_KERNEL_PRIORITY_HIGH)
+			return -EINVAL;
+		switch (*evtype) {
+		case LTTNG_TYPE_EVENT:
+			event = file->private_data;
+			return lttng_event_set_priority(event, priority);
+		case LTTNG_TYPE_ENABLER:
+			enabler = file->private_data;
+			return lttng_enabler_set_priority(enabler, priority);
+		default:
+			WARN_ON_ONCE(1);
+			return -ENOSYS;
+		}
+	}
 	default:
 		return -ENOIOCTLCMD;
 	}
@@ -1507,11 +1815,212 @@ static const struct file_operations lttng_event_fops = {
 #endif
 };
 
+/*
+ * The readiness bitmap is produced from the per-buffer deliverable state
+ * (see channel_poll_deliver_mask()). It never blocks.
+ */
+static
+ssize_t lttng_stream_ready_read(struct file *filp, char __user *user_buf,
+		size_t count, loff_t *ppos)
+{
+	struct lttng_channel *channel = filp->private_data;
+	size_t len = DIV_ROUND_UP(nr_cpu_ids, BITS_PER_BYTE);
+	unsigned long *mask;
+	uint8_t *bytes;
+	ssize_t ret;
+	int cpu;
+
+	if (count < len)
+		return -EINVAL;
+	mask = kcalloc(BITS_TO_LONGS(nr_cpu_ids), sizeof(unsigned long),
+			GFP_KERNEL);
+	if (!mask)
+		return -ENOMEM;
+	bytes = kzalloc(len, GFP_KERNEL);
+	if (!bytes) {
+		ret = -ENOMEM;
+		goto free_mask;
+	}
+	channel_poll_deliver_mask(channel->chan, mask);
+	for_each_set_bit(cpu, mask, nr_cpu_ids)
+		bytes[cpu / BITS_PER_BYTE] |= 1U << (cpu % BITS_PER_BYTE);
+	if (copy_to_user(user_buf, bytes, len))
+		ret = -EFAULT;
+	else
+		ret = len;
+	kfree(bytes);
+free_mask:
+	kfree(mask);
+	return ret;
+}
+
+static
+unsigned int lttng_stream_ready_poll(struct file *filp, poll_table *wait)
+{
+	struct lttng_channel *channel = filp->private_data;
+	struct channel *chan = channel->chan;
+	int finalized;
+
+	poll_wait(filp, &chan->read_wait, wait);
+	if (lib_ring_buffer_channel_is_disabled(chan))
+		return POLLERR;
+	finalized = lib_ring_buffer_channel_is_finalized(chan);
+	if (channel_poll_deliver_mask(chan, NULL))
+		return POLLIN | POLLRDNORM;
+	if (finalized)
+		return POLLHUP;
+	return 0;
+}
+
+static
+int lttng_stream_ready_release(struct inode *inode, struct file *file)
+{
+	struct lttng_channel *channel = file->private_data;
+
+	if (channel)
+		fput(channel->file);
+	return 0;
+}
+
+static const struct file_operations lttng_stream_ready_fops = {
+	.owner = THIS_MODULE,
+	.release = lttng_stream_ready_release,
+	.read = lttng_stream_ready_read,
+	.poll = lttng_stream_ready_poll,
+	.llseek = noop_llseek,
+};
+
 static int put_u64(uint64_t val, unsigned long arg)
 {
 	return put_user(val, (uint64_t __user *) arg);
 }
 
+/*
+ * Describe the packet held by the reader, gathering the same fields as
+ * the individual LTTNG_RING_BUFFER_GET_* commands.
+ */
+static int lttng_stream_fill_packet_info(struct lib_ring_buffer *buf,
+		struct lttng_kernel_packet_info *info)
+{
+	struct channel *chan = buf->backend.chan;
+	const struct lib_ring_buffer_config *config = &chan->backend.config;
+	const struct lttng_channel_ops *ops = chan->backend.priv_ops;
+	uint64_t ts_begin, ts_end, ed, cs, ps, si, seq, id;
+
+	if (ops->timestamp_begin(config, buf, &ts_begin) < 0
+			|| ops->timestamp_end(config, buf, &ts_end) < 0
+			|| ops->events_discarded(config, buf, &ed) < 0
+			|| ops->content_size(config, buf, &cs) < 0
+			|| ops->packet_size(config, buf, &ps) < 0
+			|| ops->stream_id(config, buf, &si) < 0
+			|| ops->sequence_number(config, buf, &seq) < 0
+			|| ops->instance_id(config, buf, &id) < 0)
+		return -ENOSYS;
+
+	memset(info, 0, sizeof(*info));
+	info->timestamp_begin = ts_begin;
+	info->timestamp_end = ts_end;
+	info->events_discarded = ed;
+	info->content_size = cs;
+	info->packet_size = ps;
+	info->padded_size =
+		PAGE_ALIGN(lib_ring_buffer_get_read_data_size(config, buf));
+	info->stream_id = si;
+	info->seq_num = seq;
+	info->instance_id = id;
+	if (config->output == RING_BUFFER_MMAP) {
+		unsigned long sb_bindex;
+
+		sb_bindex = subbuffer_id_get_index(config,
+						   buf->backend.buf_rsb.id);
+		info->mmap_read_offset =
+			buf->backend.array[sb_bindex]->mmap_offset;
+	}
+	return 0;
+}
+
+/*
+ * Split of the records discarded by the stream: normal priority records
+ * refused at the priority watermark, and buffer full drops by priority.
+ */
+static long lttng_stream_get_discarded_by_prio(struct lib_ring_buffer *buf,
+		unsigned long arg)
+{
+	const struct lib_ring_buffer_config *config =
+			&buf->backend.chan->backend.config;
+	struct lttng_kernel_discarded_by_priority discarded;
+	unsigned long full, full_high;
+
+	full = lib_ring_buffer_get_records_lost_full(config, buf);
+	full_high = lib_ring_buffer_get_records_lost_full_high(config, buf);
+	discarded.normal_watermark =
+		lib_ring_buffer_get_records_lost_prio(config, buf);
+	discarded.normal_full = full - full_high;
+	discarded.high_full = full_high;
+	if (copy_to_user((void __user *) arg, &discarded, sizeof(discarded)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Replacement pages splice took from the stream page pool, and allocated
+ * because it was empty.
+ */
+static long lttng_stream_get_page_pool_stats(struct lib_ring_buffer *buf,
+		unsigned long arg)
+{
+	const struct lib_ring_buffer_config *config =
+			&buf->backend.chan->backend.config;
+	struct lttng_kernel_page_pool_stats stats;
+
+	stats.hit = lib_ring_buffer_get_page_pool_hit(config, buf);
+	stats.miss = lib_ring_buffer_get_page_pool_miss(config, buf);
+	if (copy_to_user((void __user *) arg, &stats, sizeof(stats)))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Get the next sub-buffer and copy its description to user-space. On
+ * failure, the sub-buffer is released without being consumed.
+ */
+static long lttng_stream_get_next_packet(struct file *filp,
+		struct lib_ring_buffer *buf, unsigned long arg)
+{
+	struct lttng_kernel_packet_info info;
+	int ret;
+
+	ret = lib_ring_buffer_get_next_subbuf(buf);
+	if (ret)
+		return ret;
+	/* Set file position to zero at each successful "get" */
+	filp->f_pos = 0;
+	ret = lttng_stream_fill_packet_info(buf, &info);
+	if (ret)
+		goto put;
+	if (copy_to_user((struct lttng_kernel_packet_info __user *) arg,
+			&info, sizeof(info))) {
+		ret = -EFAULT;
+		goto put;
+	}
+	return 0;
+
+put:
+	lib_ring_buffer_put_subbuf(buf);
+	return ret;
+}
+
+/*
+ * Put the sub-buffer currently held (if any), then get the next one.
+ */
+static long lttng_stream_put_get_next_packet(struct file *filp,
+		struct lib_ring_buffer *buf, unsigned long arg)
+{
+	if (buf->get_subbuf)
+		lib_ring_buffer_put_next_subbuf(buf);
+	return lttng_stream_get_next_packet(filp, buf, arg);
+}
+
 static long lttng_stream_ring_buffer_ioctl(struct file *filp,
 		unsigned int cmd, unsigned long arg)
 {
@@ -1606,6 +2115,14 @@ static long lttng_stream_ring_buffer_ioctl(struct file *filp,
 			goto error;
 		return put_u64(id, arg);
 	}
+	case LTTNG_RING_BUFFER_GET_NEXT_PACKET:
+		return lttng_stream_get_next_packet(filp, buf, arg);
+	case LTTNG_RING_BUFFER_PUT_GET_NEXT_PACKET:
+		return lttng_stream_put_get_next_packet(filp, buf, arg);
+	case LTTNG_RING_BUFFER_GET_DISCARDED_BY_PRIO:
+		return lttng_stream_get_discarded_by_prio(buf, arg);
+	case LTTNG_RING_BUFFER_GET_PAGE_POOL_STATS:
+		return lttng_stream_get_page_pool_stats(buf, arg);
 	default:
 		return lib_ring_buffer_file_operations.unlocked_ioctl(filp,
 				cmd, arg);
@@ -1710,6 +2227,14 @@ static long lttng_stream_ring_buffer_compat_ioctl(struct file *filp,
 			goto error;
 		return put_u64(id, arg);
 	}
+	case LTTNG_RING_BUFFER_COMPAT_GET_NEXT_PACKET:
+		return lttng_stream_get_next_packet(filp, buf, arg);
+	case LTTNG_RING_BUFFER_COMPAT_PUT_GET_NEXT_PACKET:
+		return lttng_stream_put_get_next_packet(filp, buf, arg);
+	case LTTNG_RING_BUFFER_COMPAT_GET_DISCARDED_BY_PRIO:
+		return lttng_stream_get_discarded_by_prio(buf, arg);
+	case LTTNG_RING_BUFFER_COMPAT_GET_PAGE_POOL_STATS:
+		return lttng_stream_get_page_pool_stats(buf, arg);
 	default:
 		return lib_ring_buffer_file_operations.compat_ioctl(filp,
 				cmd, arg);
@@ -1731,6 +2256,8 @@ static void lttng_stream_override_ring_buffer_fops(void)
 		lib_ring_buffer_file_operations.poll;
 	lttng_stream_ring_buffer_file_operations.splice_read =
 		lib_ring_buffer_file_operations.splice_read;
+	lttng_stream_ring_buffer_file_operations.read =
+		lib_ring_buffer_file_operations.read;
 	lttng_stream_ring_buffer_file_operations.mmap =
 		lib_ring_buffer_file_operations.mmap;
 	lttng_stream_ring_buffer_file_operations.unlocked_ioctl =
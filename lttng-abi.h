@@ -30,7 +30,7 @@
  * should be increased when an incompatible ABI change is done.
  */
 #define LTTNG_MODULES_ABI_MAJOR_VERSION		2
-#define LTTNG_MODULES_ABI_MINOR_VERSION		3
+#define LTTNG_MODULES_ABI_MINOR_VERSION		14
 
 #define LTTNG_KERNEL_SYM_NAME_LEN	256
 
@@ -49,6 +49,7 @@ enum lttng_kernel_instrumentation {
 enum lttng_kernel_output {
 	LTTNG_KERNEL_SPLICE	= 0,
 	LTTNG_KERNEL_MMAP	= 1,
+	LTTNG_KERNEL_READ	= 2,
 };
 
 /*
@@ -60,9 +61,12 @@ struct lttng_kernel_channel {
 	uint64_t num_subbuf;
 	unsigned int switch_timer_interval;	/* usecs */
 	unsigned int read_timer_interval;	/* usecs */
-	enum lttng_kernel_output output;	/* splice, mmap */
+	enum lttng_kernel_output output;	/* splice, mmap, read */
 	int overwrite;				/* 1: overwrite, 0: discard */
-	char padding[LTTNG_KERNEL_CHANNEL_PADDING];
+	uint32_t num_reader_subbuf;		/* held by reader, 0: 1 */
+	uint32_t lazy_alloc;			/* 1: per-cpu buffers on first event */
+	uint32_t per_node;			/* 1: one buffer per NUMA node */
+	char padding[LTTNG_KERNEL_CHANNEL_PADDING - 3 * sizeof(uint32_t)];
 } __attribute__((packed));
 
 struct lttng_kernel_kretprobe {
@@ -174,6 +178,98 @@ struct lttng_kernel_filter_bytecode {
 	char data[0];
 } __attribute__((packed));
 
+/*
+ * Streams opened by LTTNG_KERNEL_STREAM_LIST. count is the capacity of the
+ * streams array on input, and the number of streams opened on output.
+ * cpu is -1 for global buffers, and the NUMA node for per-node channels.
+ */
+struct lttng_kernel_stream_fd {
+	int32_t fd;
+	int32_t cpu;
+} __attribute__((packed));
+
+struct lttng_kernel_stream_list {
+	uint32_t count;
+	struct lttng_kernel_stream_fd streams[];
+} __attribute__((packed));
+
+/*
+ * Records lost by the events of a channel, indexed by event id, summed over
+ * all CPUs. count is the capacity of the lost array on input, and the number
+ * of event ids accounted for on output: it can be larger than the capacity,
+ * in which case only the first entries are filled.
+ */
+#define LTTNG_KERNEL_EVENT_LOST_MAX		65536
+struct lttng_kernel_event_lost_list {
+	uint32_t count;
+	uint64_t lost[];
+} __attribute__((packed));
+
+/*
+ * Layout of the channel-wide mmap (mmap of an mmap channel file
+ * descriptor), returned by LTTNG_KERNEL_CHANNEL_MMAP_LAYOUT. One entry per
+ * stream, giving the offset of its buffer in the mapping. If count (entry
+ * capacity) is too small, only count is updated, with the number of
+ * entries required.
+ */
+struct lttng_kernel_channel_mmap_entry {
+	int32_t cpu;
+	uint32_t padding;
+	uint64_t offset;
+} __attribute__((packed));
+
+struct lttng_kernel_channel_mmap_layout {
+	uint64_t len;			/* length of the whole mapping */
+	uint64_t stream_len;		/* length of each stream mapping */
+	uint32_t count;
+	struct lttng_kernel_channel_mmap_entry entries[];
+} __attribute__((packed));
+
+/*
+ * Packet description returned along with the sub-buffer by
+ * LTTNG_RING_BUFFER_GET_NEXT_PACKET and LTTNG_RING_BUFFER_PUT_GET_NEXT_PACKET.
+ * mmap_read_offset is only valid for mmap streams, and is 0 otherwise.
+ */
+#define LTTNG_KERNEL_PACKET_INFO_PADDING	32
+struct lttng_kernel_packet_info {
+	uint64_t timestamp_begin;
+	uint64_t timestamp_end;
+	uint64_t events_discarded;
+	uint64_t content_size;		/* in bits */
+	uint64_t packet_size;		/* in bits */
+	uint64_t padded_size;		/* in bytes, page-aligned */
+	uint64_t stream_id;
+	uint64_t seq_num;
+	uint64_t instance_id;
+	uint64_t mmap_read_offset;	/* in bytes */
+	char padding[LTTNG_KERNEL_PACKET_INFO_PADDING];
+} __attribute__((packed));
+
+/*
+ * Records discarded by a stream, by cause of the priority-aware discard:
+ * normal priority records refused above the channel priority watermark, and
+ * records dropped because the buffer was full, by priority.
+ */
+struct lttng_kernel_discarded_by_priority {
+	uint64_t normal_watermark;
+	uint64_t normal_full;
+	uint64_t high_full;
+} __attribute__((packed));
+
+/*
+ * Replacement pages taken by splice from the stream page pool (hit), and
+ * allocated because the pool was empty (miss). Both are 0 for streams
+ * without page pool.
+ */
+struct lttng_kernel_page_pool_stats {
+	uint64_t hit;
+	uint64_t miss;
+} __attribute__((packed));
+
+/* Event priorities, see LTTNG_KERNEL_PRIORITY. */
+#define LTTNG_KERNEL_PRIORITY_NORMAL		0
+#define LTTNG_KERNEL_PRIORITY_HIGH		1
+
 /* LTTng file descriptor ioctl */
 #define LTTNG_KERNEL_SESSION			_IO(0xF6, 0x45)
 #define LTTNG_KERNEL_TRACER_VERSION		\
@@ -213,6 +309,42 @@ struct lttng_kernel_filter_bytecode {
 	_IOW(0xF6, 0x63, struct lttng_kernel_event)
 #define LTTNG_KERNEL_SYSCALL_MASK		\
 	_IOWR(0xF6, 0x64, struct lttng_kernel_syscall_mask)
+/*
+ * Returns a channel-wide readiness file descriptor. It is pollable, and
+ * read() returns a bitmap of the streams (by cpu) having a packet ready
+ * to be consumed, as an array of bytes, bit N being bit (N % 8) of byte
+ * (N / 8).
+ */
+#define LTTNG_KERNEL_STREAM_READY		_IO(0xF6, 0x65)
+#define LTTNG_KERNEL_STREAM_LIST		\
+	_IOWR(0xF6, 0x66, struct lttng_kernel_stream_list)
+#define LTTNG_KERNEL_CHANNEL_MMAP_LAYOUT	\
+	_IOWR(0xF6, 0x67, struct lttng_kernel_channel_mmap_layout)
+/*
+ * Sets the number of sub-buffers of the channel buffers (power of 2). The
+ * streams stay open: each stream must keep being read for its buffer to be
+ * resized. Data not consumed is kept, except for the oldest packets of an
+ * overwrite mode buffer which no longer fit.
+ */
+#define LTTNG_KERNEL_CHANNEL_RESIZE		_IOW(0xF6, 0x68, uint64_t)
+/*
+ * Sets the maximum age of the data of an overwrite mode channel, in usecs:
+ * older packets are dropped rather than kept until overwritten. 0 keeps
+ * whatever fits in the buffers.
+ */
+#define LTTNG_KERNEL_CHANNEL_RETENTION		_IOW(0xF6, 0x69, uint64_t)
+/*
+ * Discard mode: sets the unconsumed data size, in bytes, of a stream above
+ * which only high priority events are recorded. 0 disables it.
+ */
+#define LTTNG_KERNEL_CHANNEL_PRIO_WATERMARK	_IOW(0xF6, 0x6A, uint64_t)
+/*
+ * Starts counting the records lost by each event of the channel, for event
+ * ids below the given count (at most LTTNG_KERNEL_EVENT_LOST_MAX).
+ */
+#define LTTNG_KERNEL_CHANNEL_EVENT_LOST_ENABLE	_IOW(0xF6, 0x6B, uint32_t)
+#define LTTNG_KERNEL_CHANNEL_EVENT_LOST		\
+	_IOWR(0xF6, 0x6C, struct lttng_kernel_event_lost_list)
 
 /* Event and Channel FD ioctl */
 #define LTTNG_KERNEL_CONTEXT			\
@@ -225,6 +357,9 @@ struct lttng_kernel_filter_bytecode {
 /* Event FD ioctl */
 #define LTTNG_KERNEL_FILTER			_IO(0xF6, 0x90)
 
+/* Event and enabler FD ioctl: sets the event priority */
+#define LTTNG_KERNEL_PRIORITY			_IOW(0xF6, 0x91, uint32_t)
+
 /* LTTng-specific ioctls for the lib ringbuffer */
 /* returns the timestamp begin of the current sub-buffer */
 #define LTTNG_RING_BUFFER_GET_TIMESTAMP_BEGIN	_IOR(0xF6, 0x20, uint64_t)
@@ -244,6 +379,18 @@ struct lttng_kernel_filter_bytecode {
 #define LTTNG_RING_BUFFER_GET_SEQ_NUM		_IOR(0xF6, 0x27, uint64_t)
 /* returns the stream instance id */
 #define LTTNG_RING_BUFFER_INSTANCE_ID		_IOR(0xF6, 0x28, uint64_t)
+/* get the next sub-buffer and return its packet description */
+#define LTTNG_RING_BUFFER_GET_NEXT_PACKET	\
+	_IOR(0xF6, 0x29, struct lttng_kernel_packet_info)
+/* put the current sub-buffer, get the next one and describe it */
+#define LTTNG_RING_BUFFER_PUT_GET_NEXT_PACKET	\
+	_IOR(0xF6, 0x2A, struct lttng_kernel_packet_info)
+/* returns the records discarded, by priority */
+#define LTTNG_RING_BUFFER_GET_DISCARDED_BY_PRIO	\
+	_IOR(0xF6, 0x2B, struct lttng_kernel_discarded_by_priority)
+/* returns the splice page pool statistics */
+#define LTTNG_RING_BUFFER_GET_PAGE_POOL_STATS	\
+	_IOR(0xF6, 0x2C, struct lttng_kernel_page_pool_stats)
 
 #ifdef CONFIG_COMPAT
 /* returns the timestamp begin of the current sub-buffer */
@@ -273,6 +420,18 @@ struct lttng_kernel_filter_bytecode {
 /* returns the stream instance id */
 #define LTTNG_RING_BUFFER_COMPAT_INSTANCE_ID	\
 	LTTNG_RING_BUFFER_INSTANCE_ID
+/* get the next sub-buffer and return its packet description */
+#define LTTNG_RING_BUFFER_COMPAT_GET_NEXT_PACKET	\
+	LTTNG_RING_BUFFER_GET_NEXT_PACKET
+/* put the current sub-buffer, get the next one and describe it */
+#define LTTNG_RING_BUFFER_COMPAT_PUT_GET_NEXT_PACKET	\
+	LTTNG_RING_BUFFER_PUT_GET_NEXT_PACKET
+/* returns the records discarded, by priority */
+#define LTTNG_RING_BUFFER_COMPAT_GET_DISCARDED_BY_PRIO	\
+	LTTNG_RING_BUFFER_GET_DISCARDED_BY_PRIO
+/* returns the splice page pool statistics */
+#define LTTNG_RING_BUFFER_COMPAT_GET_PAGE_POOL_STATS	\
+	LTTNG_RING_BUFFER_GET_PAGE_POOL_STATS
 #endif /* CONFIG_COMPAT */
 
 #endif /* _LTTNG_ABI_H */
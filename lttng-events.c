@@ -40,6 +40,7 @@
 #include <linux/jhash.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
+#include <linux/math64.h>
 
 #include <wrapper/uuid.h>
 #include <wrapper/vmalloc.h>	/* for wrapper_vmalloc_sync_all() */
@@ -390,6 +391,95 @@ end:
 	return ret;
 }
 
+/*
+ * Change the number of sub-buffers of the channel buffers, while the streams
+ * are being read. Not called with the sessions mutex held: the resize waits
+ * for the consumer, and the channel file keeps the channel alive.
+ */
+int lttng_channel_resize(struct lttng_channel *channel, uint64_t num_subbuf)
+{
+	if (num_subbuf > LTTNG_SIZE_MAX)
+		return -EINVAL;
+	if (channel->channel_type == METADATA_CHANNEL)
+		return -EPERM;
+	if (!channel->ops->channel_resize)
+		return -ENOSYS;
+	return channel->ops->channel_resize(channel->chan, num_subbuf);
+}
+
+/*
+ * Overwrite mode channels only: drop the packets which ended more than
+ * @usecs ago.
+ */
+int lttng_channel_set_retention(struct lttng_channel *channel, uint64_t usecs)
+{
+	const struct lib_ring_buffer_config *config =
+			&channel->chan->backend.config;
+	uint64_t tcf = trace_clock_freq(), max_age;
+
+	if (channel->channel_type == METADATA_CHANNEL)
+		return -EPERM;
+	if (config->mode != RING_BUFFER_OVERWRITE)
+		return -EINVAL;
+	if (usecs > div64_u64(~0ULL, tcf))
+		return -EINVAL;
+	max_age = usecs * tcf;
+	do_div(max_age, USEC_PER_SEC);
+	channel_set_retention(channel->chan, max_age);
+	return 0;
+}
+
+int lttng_channel_set_prio_watermark(struct lttng_channel *channel,
+		uint64_t watermark)
+{
+	const struct lib_ring_buffer_config *config =
+			&channel->chan->backend.config;
+
+	if (channel->channel_type == METADATA_CHANNEL)
+		return -EPERM;
+	if (config->mode != RING_BUFFER_DISCARD)
+		return -EINVAL;
+	if (watermark > channel->chan->backend.buf_size)
+		return -EINVAL;
+	channel_set_prio_watermark(channel->chan, watermark);
+	return 0;
+}
+
+/*
+ * Per-event lost records accounting is enabled once, and stays enabled until
+ * the channel is destroyed: the tracing fast path only needs the pointer to
+ * be published after the length.
+ */
+int lttng_channel_event_lost_enable(struct lttng_channel *channel,
+		uint32_t nr_events)
+{
+	local_t __percpu *event_lost;
+	int ret = 0;
+
+	if (!nr_events || nr_events > LTTNG_KERNEL_EVENT_LOST_MAX)
+		return -EINVAL;
+	mutex_lock(&sessions_mutex);
+	if (channel->channel_type == METADATA_CHANNEL) {
+		ret = -EPERM;
+		goto end;
+	}
+	if (channel->event_lost) {
+		ret = -EBUSY;
+		goto end;
+	}
+	event_lost = __alloc_percpu(nr_events * sizeof(local_t),
+			__alignof__(local_t));
+	if (!event_lost) {
+		ret = -ENOMEM;
+		goto end;
+	}
+	channel->event_lost_len = nr_events;
+	rcu_assign_pointer(channel->event_lost, event_lost);
+end:
+	mutex_unlock(&sessions_mutex);
+	return ret;
+}
+
 int lttng_event_enable(struct lttng_event *event)
 {
 	int ret = 0;
@@ -460,6 +550,32 @@ end:
 	return ret;
 }
 
+/*
+ * The priority of tracepoint and syscall events follows their enablers.
+ */
+int lttng_event_set_priority(struct lttng_event *event, unsigned int priority)
+{
+	int ret = 0;
+
+	mutex_lock(&sessions_mutex);
+	if (event->chan->channel_type == METADATA_CHANNEL) {
+		ret = -EPERM;
+		goto end;
+	}
+	switch (event->instrumentation) {
+	case LTTNG_KERNEL_TRACEPOINT:
+	case LTTNG_KERNEL_SYSCALL:
+		ret = -EINVAL;
+		break;
+	default:
+		ACCESS_ONCE(event->priority) = priority;
+		break;
+	}
+end:
+	mutex_unlock(&sessions_mutex);
+	return ret;
+}
+
 static struct lttng_transport *lttng_transport_find(const char *name)
 {
 	struct lttng_transport *transport;
@@ -475,6 +591,8 @@ struct lttng_channel *lttng_channel_create(struct lttng_session *session,
 				       const char *transport_name,
 				       void *buf_addr,
 				       size_t subbuf_size, size_t num_subbuf,
+				       unsigned int num_reader_subbuf,
+				       int lazy_alloc,
 				       unsigned int switch_timer_interval,
 				       unsigned int read_timer_interval,
 				       enum channel_type channel_type)
@@ -508,7 +626,8 @@ struct lttng_channel *lttng_channel_create(struct lttng_session *session,
 	 */
 	chan->chan = transport->ops.channel_create(transport_name,
 			chan, buf_addr, subbuf_size, num_subbuf,
-			switch_timer_interval, read_timer_interval);
+			num_reader_subbuf, lazy_alloc, switch_timer_interval,
+			read_timer_interval);
 	if (!chan->chan)
 		goto create_error;
 	chan->tstate = 1;
@@ -542,6 +661,7 @@ void _lttng_channel_destroy(struct lttng_channel *chan)
 	module_put(chan->transport->owner);
 	list_del(&chan->list);
 	lttng_destroy_context(chan->ctx);
+	free_percpu(chan->event_lost);
 	kfree(chan);
 }
 
@@ -1417,6 +1537,16 @@ int lttng_enabler_disable(struct lttng_enabler *enabler)
 	return 0;
 }
 
+int lttng_enabler_set_priority(struct lttng_enabler *enabler,
+		unsigned int priority)
+{
+	mutex_lock(&sessions_mutex);
+	enabler->priority = priority;
+	lttng_session_lazy_sync_enablers(enabler->chan->session);
+	mutex_unlock(&sessions_mutex);
+	return 0;
+}
+
 int lttng_enabler_attach_bytecode(struct lttng_enabler *enabler,
 		struct lttng_kernel_filter_bytecode __user *bytecode)
 {
@@ -1493,16 +1623,21 @@ void lttng_session_sync_enablers(struct lttng_session *session)
 		struct lttng_enabler_ref *enabler_ref;
 		struct lttng_bytecode_runtime *runtime;
 		int enabled = 0, has_enablers_without_bytecode = 0;
+		unsigned int priority = 0;
 
 		switch (event->instrumentation) {
 		case LTTNG_KERNEL_TRACEPOINT:
 		case LTTNG_KERNEL_SYSCALL:
-			/* Enable events */
+			/*
+			 * Enable events, with the highest priority of
+			 * their enabled enablers.
+			 */
 			list_for_each_entry(enabler_ref,
 					&event->enablers_ref_head, node) {
 				if (enabler_ref->ref->enabled) {
 					enabled = 1;
-					break;
+					priority = max(priority,
+						enabler_ref->ref->priority);
 				}
 			}
 			break;
@@ -1517,6 +1652,7 @@ void lttng_session_sync_enablers(struct lttng_session *session)
 		 */
 		enabled = enabled && session->tstate && event->chan->tstate;
 
+		ACCESS_ONCE(event->priority) = priority;
 		ACCESS_ONCE(event->enabled) = enabled;
 		/*
 		 * Sync tracepoint registration with event enabled
@@ -2308,10 +2444,12 @@ int _lttng_channel_metadata_statedump(struct lttng_session *session,
 		"stream {\n"
 		"	id = %u;\n"
 		"	event.header := %s;\n"
-		"	packet.context := struct packet_context;\n",
+		"	packet.context := struct %s;\n",
 		chan->id,
 		chan->header_type == 1 ? "struct event_header_compact" :
-			"struct event_header_large");
+			"struct event_header_large",
+		chan->channel_type == PER_NODE_CHANNEL ?
+			"packet_context_node" : "packet_context");
 	if (ret)
 		goto end;
 
@@ -2355,6 +2493,19 @@ int _lttng_stream_packet_context_declare(struct lttng_session *session)
 		"	unsigned long events_discarded;\n"
 		"	uint32_t cpu_id;\n"
 		"};\n\n"
+		/*
+		 * Per-node streams: stream_instance_id, and the last field,
+		 * are the NUMA node of the stream.
+		 */
+		"struct packet_context_node {\n"
+		"	uint64_clock_monotonic_t timestamp_begin;\n"
+		"	uint64_clock_monotonic_t timestamp_end;\n"
+		"	uint64_t content_size;\n"
+		"	uint64_t packet_size;\n"
+		"	uint64_t packet_seq_num;\n"
+		"	unsigned long events_discarded;\n"
+		"	uint32_t node_id;\n"
+		"};\n\n"
 		);
 }
 
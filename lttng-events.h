@@ -27,8 +27,11 @@
 #include <linux/list.h>
 #include <linux/kprobes.h>
 #include <linux/kref.h>
+#include <linux/percpu.h>
+#include <asm/local.h>
 #include <lttng-cpuhotplug.h>
 #include <wrapper/uuid.h>
+#include <wrapper/rcu.h>
 #include <lttng-tracer.h>
 #include <lttng-abi.h>
 #include <lttng-abi-old.h>
@@ -68,6 +71,7 @@ enum lttng_string_encodings {
 enum channel_type {
 	PER_CPU_CHANNEL,
 	METADATA_CHANNEL,
+	PER_NODE_CHANNEL,
 };
 
 struct lttng_enum_value {
@@ -321,6 +325,7 @@ struct lttng_event {
 	/* list of struct lttng_bytecode_runtime, sorted by seqnum */
 	struct list_head bytecode_runtime_head;
 	int has_enablers_without_bytecode;
+	unsigned int priority;		/* LTTNG_KERNEL_PRIORITY_* */
 };
 
 enum lttng_enabler_type {
@@ -344,6 +349,7 @@ struct lttng_enabler {
 	struct lttng_kernel_event event_param;
 	struct lttng_channel *chan;
 	struct lttng_ctx *ctx;
+	unsigned int priority;		/* LTTNG_KERNEL_PRIORITY_* */
 	unsigned int enabled:1;
 };
 
@@ -352,9 +358,12 @@ struct lttng_channel_ops {
 				struct lttng_channel *lttng_chan,
 				void *buf_addr,
 				size_t subbuf_size, size_t num_subbuf,
+				unsigned int num_reader_subbuf,
+				int lazy_alloc,
 				unsigned int switch_timer_interval,
 				unsigned int read_timer_interval);
 	void (*channel_destroy)(struct channel *chan);
+	int (*channel_resize)(struct channel *chan, size_t num_subbuf);
 	struct lib_ring_buffer *(*buffer_read_open)(struct channel *chan);
 	int (*buffer_has_read_closed_stream)(struct channel *chan);
 	void (*buffer_read_close)(struct lib_ring_buffer *buf);
@@ -381,6 +390,13 @@ struct lttng_channel_ops {
 	wait_queue_head_t *(*get_hp_wait_queue)(struct channel *chan);
 	int (*is_finalized)(struct channel *chan);
 	int (*is_disabled)(struct channel *chan);
+	/*
+	 * full_hint tells probes that the buffer used by @cpu is full, so
+	 * they drop their record early and account for it with
+	 * event_lost_full, without preparing it.
+	 */
+	int (*full_hint)(struct channel *chan, int cpu);
+	void (*event_lost_full)(struct channel *chan, unsigned int rflags);
 	int (*timestamp_begin) (const struct lib_ring_buffer_config *config,
 			struct lib_ring_buffer *bufb,
 			uint64_t *timestamp_begin);
@@ -449,6 +465,9 @@ struct lttng_channel {
 	struct lttng_syscall_filter *sc_filter;
 	int header_type;		/* 0: unset, 1: compact, 2: large */
 	enum channel_type channel_type;
+	/* Per-cpu lost records count, by event id (optional) */
+	local_t __percpu *event_lost;
+	unsigned int event_lost_len;	/* Number of event ids counted */
 	unsigned int metadata_dumped:1,
 		sys_enter_registered:1,
 		sys_exit_registered:1,
@@ -534,6 +553,8 @@ struct lttng_enabler *lttng_enabler_create(enum lttng_enabler_type type,
 
 int lttng_enabler_enable(struct lttng_enabler *enabler);
 int lttng_enabler_disable(struct lttng_enabler *enabler);
+int lttng_enabler_set_priority(struct lttng_enabler *enabler,
+		unsigned int priority);
 int lttng_fix_pending_events(void);
 int lttng_session_active(void);
 
@@ -549,6 +570,8 @@ struct lttng_channel *lttng_channel_create(struct lttng_session *session,
 				       const char *transport_name,
 				       void *buf_addr,
 				       size_t subbuf_size, size_t num_subbuf,
+				       unsigned int num_reader_subbuf,
+				       int lazy_alloc,
 				       unsigned int switch_timer_interval,
 				       unsigned int read_timer_interval,
 				       enum channel_type channel_type);
@@ -576,8 +599,31 @@ struct lttng_event *lttng_event_compat_old_create(struct lttng_channel *chan,
 
 int lttng_channel_enable(struct lttng_channel *channel);
 int lttng_channel_disable(struct lttng_channel *channel);
+int lttng_channel_resize(struct lttng_channel *channel, uint64_t num_subbuf);
+int lttng_channel_set_retention(struct lttng_channel *channel, uint64_t usecs);
+int lttng_channel_set_prio_watermark(struct lttng_channel *channel,
+		uint64_t watermark);
+int lttng_channel_event_lost_enable(struct lttng_channel *channel,
+		uint32_t nr_events);
 int lttng_event_enable(struct lttng_event *event);
 int lttng_event_disable(struct lttng_event *event);
+int lttng_event_set_priority(struct lttng_event *event, unsigned int priority);
+
+/*
+ * Count a record of event @event_id lost by @chan on @cpu, if per-event
+ * accounting is enabled. Called from the tracing fast path, with preemption
+ * disabled.
+ */
+static inline
+void lttng_channel_event_lost(struct lttng_channel *chan,
+		unsigned int event_id, int cpu)
+{
+	local_t __percpu *event_lost = lttng_rcu_dereference(chan->event_lost);
+
+	if (likely(!event_lost) || event_id >= chan->event_lost_len)
+		return;
+	local_inc(per_cpu_ptr(event_lost, cpu) + event_id);
+}
 
 void lttng_transport_register(struct lttng_transport *transport);
 void lttng_transport_unregister(struct lttng_transport *transport);
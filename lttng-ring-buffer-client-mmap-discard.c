@@ -26,6 +26,9 @@
 #define RING_BUFFER_MODE_TEMPLATE		RING_BUFFER_DISCARD
 #define RING_BUFFER_MODE_TEMPLATE_STRING	"discard-mmap"
 #define RING_BUFFER_OUTPUT_TEMPLATE		RING_BUFFER_MMAP
+#if defined(CONFIG_LTTNG_RING_BUFFER_VMAP) && defined(CONFIG_64BIT)
+#define RING_BUFFER_BACKEND_TEMPLATE		RING_BUFFER_VMAP
+#endif
 #include "lttng-ring-buffer-client.h"
 
 MODULE_LICENSE("GPL and additional rights");
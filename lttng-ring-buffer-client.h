@@ -29,6 +29,24 @@
 #include <lttng-tracer.h>
 #include <wrapper/ringbuffer/frontend_types.h>
 
+/*
+ * Clients not using splice may map their sub-buffers contiguously, on
+ * architectures where vmalloc space is not scarce, when built with
+ * CONFIG_LTTNG_RING_BUFFER_VMAP. Page backed sub-buffers are the default.
+ */
+#ifndef RING_BUFFER_BACKEND_TEMPLATE
+#define RING_BUFFER_BACKEND_TEMPLATE		RING_BUFFER_PAGE
+#endif
+
+/*
+ * Per-node clients share a buffer among the cpus of each NUMA node, which
+ * requires global synchronization.
+ */
+#ifndef RING_BUFFER_ALLOC_TEMPLATE
+#define RING_BUFFER_ALLOC_TEMPLATE		RING_BUFFER_ALLOC_PER_CPU
+#define RING_BUFFER_SYNC_TEMPLATE		RING_BUFFER_SYNC_PER_CPU
+#endif
+
 #define LTTNG_COMPACT_EVENT_BITS	5
 #define LTTNG_COMPACT_TSC_BITS		27
 
@@ -71,7 +89,10 @@ struct packet_header {
 						 * the beginning of the trace.
 						 * (may overflow)
 						 */
-		uint32_t cpu_id;		/* CPU id associated with stream */
+		uint32_t cpu_id;		/*
+						 * CPU id associated with stream,
+						 * NUMA node for per-node streams
+						 */
 		uint8_t header_end;		/* End of header */
 	} ctx;
 };
@@ -202,7 +223,9 @@ void lttng_write_event_header(const struct lib_ring_buffer_config *config,
 	struct lttng_probe_ctx *lttng_probe_ctx = ctx->priv;
 	struct lttng_event *event = lttng_probe_ctx->event;
 
-	if (unlikely(ctx->rflags))
+	/* The record priority does not change the header layout. */
+	if (unlikely(ctx->rflags
+			& (RING_BUFFER_RFLAG_FULL_TSC | LTTNG_RFLAG_EXTENDED)))
 		goto slow_path;
 
 	switch (lttng_chan->header_type) {
@@ -361,7 +384,7 @@ static void client_buffer_begin(struct lib_ring_buffer *buf, u64 tsc,
 	header->ctx.timestamp_end = 0;
 	header->ctx.content_size = ~0ULL; /* for debugging */
 	header->ctx.packet_size = ~0ULL;
-	header->ctx.packet_seq_num = chan->backend.num_subbuf * \
+	header->ctx.packet_seq_num = buf->backend.num_subbuf * \
 				     buf->backend.buf_cnt[subbuf_idx].seq_cnt + \
 				     subbuf_idx;
 	header->ctx.events_discarded = 0;
@@ -390,7 +413,23 @@ static void client_buffer_end(struct lib_ring_buffer *buf, u64 tsc,
 	records_lost += lib_ring_buffer_get_records_lost_full(&client_config, buf);
 	records_lost += lib_ring_buffer_get_records_lost_wrap(&client_config, buf);
 	records_lost += lib_ring_buffer_get_records_lost_big(&client_config, buf);
+	records_lost += lib_ring_buffer_get_records_lost_prio(&client_config, buf);
+	records_lost += lib_ring_buffer_get_records_lost_alloc(&client_config, buf);
+	records_lost += lib_ring_buffer_get_records_lost_resize(&client_config, buf);
 	header->ctx.events_discarded = records_lost;
+
+	if (lib_ring_buffer_packet_index_enabled(buf)) {
+		struct lib_ring_buffer_packet_index entry;
+
+		entry.seq_num = header->ctx.packet_seq_num;
+		entry.offset = entry.seq_num << chan->backend.subbuf_size_order;
+		entry.timestamp_begin = header->ctx.timestamp_begin;
+		entry.timestamp_end = tsc;
+		entry.content_size = data_size;
+		entry.packet_size = PAGE_ALIGN(data_size);
+		entry.events_discarded = records_lost;
+		lib_ring_buffer_packet_index_append(buf, &entry);
+	}
 }
 
 static int client_buffer_create(struct lib_ring_buffer *buf, void *priv,
@@ -511,10 +550,11 @@ static const struct lib_ring_buffer_config client_config = {
 	.cb.buffer_finalize = client_buffer_finalize,
 
 	.tsc_bits = LTTNG_COMPACT_TSC_BITS,
-	.alloc = RING_BUFFER_ALLOC_PER_CPU,
-	.sync = RING_BUFFER_SYNC_PER_CPU,
+	.alloc = RING_BUFFER_ALLOC_TEMPLATE,
+	.sync = RING_BUFFER_SYNC_TEMPLATE,
 	.mode = RING_BUFFER_MODE_TEMPLATE,
-	.backend = RING_BUFFER_PAGE,
+	.backend = RING_BUFFER_BACKEND_TEMPLATE,
+	.page_order = RING_BUFFER_PAGE_HIGH_ORDER,
 	.output = RING_BUFFER_OUTPUT_TEMPLATE,
 	.oops = RING_BUFFER_OOPS_CONSISTENCY,
 	.ipi = RING_BUFFER_IPI_BARRIER,
@@ -533,17 +573,26 @@ void lttng_channel_destroy(struct channel *chan)
 	channel_destroy(chan);
 }
 
+static
+int _channel_resize(struct channel *chan, size_t num_subbuf)
+{
+	return channel_resize(chan, num_subbuf);
+}
+
 static
 struct channel *_channel_create(const char *name,
 				struct lttng_channel *lttng_chan, void *buf_addr,
 				size_t subbuf_size, size_t num_subbuf,
+				unsigned int num_reader_subbuf,
+				int lazy_alloc,
 				unsigned int switch_timer_interval,
 				unsigned int read_timer_interval)
 {
 	struct channel *chan;
 
 	chan = channel_create(&client_config, name, lttng_chan, buf_addr,
-			      subbuf_size, num_subbuf, switch_timer_interval,
+			      subbuf_size, num_subbuf, num_reader_subbuf,
+			      lazy_alloc, switch_timer_interval,
 			      read_timer_interval);
 	if (chan) {
 		/*
@@ -603,6 +652,7 @@ int lttng_event_reserve(struct lib_ring_buffer_ctx *ctx,
 		      uint32_t event_id)
 {
 	struct lttng_channel *lttng_chan = channel_get_private(ctx->chan);
+	struct lttng_probe_ctx *lttng_probe_ctx = ctx->priv;
 	int ret, cpu;
 
 	cpu = lib_ring_buffer_get_cpu(&client_config);
@@ -622,10 +672,15 @@ int lttng_event_reserve(struct lib_ring_buffer_ctx *ctx,
 	default:
 		WARN_ON_ONCE(1);
 	}
+	if (unlikely(lttng_probe_ctx->event->priority))
+		ctx->rflags |= RING_BUFFER_RFLAG_HIGH_PRIO;
 
 	ret = lib_ring_buffer_reserve(&client_config, ctx);
-	if (unlikely(ret))
+	if (unlikely(ret)) {
+		if (ret != -EAGAIN)
+			lttng_channel_event_lost(lttng_chan, event_id, cpu);
 		goto put;
+	}
 	lib_ring_buffer_backend_get_pages(&client_config, ctx,
 			&ctx->backend_pages);
 	lttng_write_event_header(&client_config, ctx, event_id);
@@ -678,6 +733,32 @@ void lttng_event_strcpy_from_user(struct lib_ring_buffer_ctx *ctx,
 			len, '#');
 }
 
+/*
+ * Discard mode: the buffer used by @cpu was found full, and the reader did not
+ * consume anything since. Buffers with a consumer page never set the hint.
+ */
+static
+int lttng_full_hint(struct channel *chan, int cpu)
+{
+	struct lib_ring_buffer *buf;
+
+	if (client_config.mode != RING_BUFFER_DISCARD)
+		return 0;
+	if (client_config.alloc == RING_BUFFER_ALLOC_PER_CPU)
+		buf = per_cpu_ptr(chan->backend.buf, cpu);
+	else if (client_config.alloc == RING_BUFFER_ALLOC_PER_NODE)
+		buf = &chan->backend.buf[cpu_to_node(cpu)];
+	else
+		buf = chan->backend.buf;
+	return ACCESS_ONCE(buf->full_hint);
+}
+
+static
+void lttng_event_lost_full(struct channel *chan, unsigned int rflags)
+{
+	lib_ring_buffer_lost_event_full(chan, rflags);
+}
+
 static
 wait_queue_head_t *lttng_get_writer_buf_wait_queue(struct channel *chan, int cpu)
 {
@@ -710,6 +791,7 @@ static struct lttng_transport lttng_relay_transport = {
 	.ops = {
 		.channel_create = _channel_create,
 		.channel_destroy = lttng_channel_destroy,
+		.channel_resize = _channel_resize,
 		.buffer_read_open = lttng_buffer_read_open,
 		.buffer_has_read_closed_stream =
 			lttng_buffer_has_read_closed_stream,
@@ -726,6 +808,8 @@ static struct lttng_transport lttng_relay_transport = {
 		.get_hp_wait_queue = lttng_get_hp_wait_queue,
 		.is_finalized = lttng_is_finalized,
 		.is_disabled = lttng_is_disabled,
+		.full_hint = lttng_full_hint,
+		.event_lost_full = lttng_event_lost_full,
 		.timestamp_begin = client_timestamp_begin,
 		.timestamp_end = client_timestamp_end,
 		.events_discarded = client_events_discarded,
@@ -250,6 +250,8 @@ static
 struct channel *_channel_create(const char *name,
 				struct lttng_channel *lttng_chan, void *buf_addr,
 				size_t subbuf_size, size_t num_subbuf,
+				unsigned int num_reader_subbuf,
+				int lazy_alloc,
 				unsigned int switch_timer_interval,
 				unsigned int read_timer_interval)
 {
@@ -257,8 +259,10 @@ struct channel *_channel_create(const char *name,
 
 	chan = channel_create(&client_config, name,
 			      lttng_chan->session->metadata_cache, buf_addr,
-			      subbuf_size, num_subbuf, switch_timer_interval,
-			      read_timer_interval);
+			      subbuf_size, num_subbuf,
+			      1,	/* Metadata is read sequentially */
+			      0,	/* Global buffer */
+			      switch_timer_interval, read_timer_interval);
 	if (chan) {
 		/*
 		 * Ensure this module is not unloaded before we finish
@@ -400,6 +404,18 @@ int lttng_is_disabled(struct channel *chan)
 	return lib_ring_buffer_channel_is_disabled(chan);
 }
 
+/* Metadata is written by the session daemon, never dropped by probes. */
+static
+int lttng_full_hint(struct channel *chan, int cpu)
+{
+	return 0;
+}
+
+static
+void lttng_event_lost_full(struct channel *chan, unsigned int rflags)
+{
+}
+
 static struct lttng_transport lttng_relay_transport = {
 	.name = "relay-" RING_BUFFER_MODE_TEMPLATE_STRING,
 	.owner = THIS_MODULE,
@@ -421,6 +437,8 @@ static struct lttng_transport lttng_relay_transport = {
 		.get_hp_wait_queue = lttng_get_hp_wait_queue,
 		.is_finalized = lttng_is_finalized,
 		.is_disabled = lttng_is_disabled,
+		.full_hint = lttng_full_hint,
+		.event_lost_full = lttng_event_lost_full,
 		.timestamp_begin = client_timestamp_begin,
 		.timestamp_end = client_timestamp_end,
 		.events_discarded = client_events_discarded,
@@ -1152,6 +1152,14 @@ static void __event_probe__##_name(void *__data, _proto)		      \
 	__lpf = lttng_rcu_dereference(__session->pid_tracker);		      \
 	if (__lpf && likely(!lttng_pid_tracker_lookup(__lpf, current->pid)))  \
 		return;							      \
+	if (unlikely(__chan->ops->full_hint(__chan->chan,		      \
+			smp_processor_id()))) {				      \
+		__chan->ops->event_lost_full(__chan->chan,		      \
+			__event->priority ? RING_BUFFER_RFLAG_HIGH_PRIO : 0); \
+		lttng_channel_event_lost(__chan, __event->id,		      \
+			smp_processor_id());				      \
+		return;							      \
+	}								      \
 	__orig_dynamic_len_offset = this_cpu_ptr(&lttng_dynamic_len_stack)->offset; \
 	__dynamic_len_idx = __orig_dynamic_len_offset;			      \
 	_code_pre							      \
@@ -1172,6 +1180,8 @@ static void __event_probe__##_name(void *__data, _proto)		      \
 	__event_len = __event_get_size__##_name(tp_locvar, _args);	      \
 	if (unlikely(__event_len < 0)) {				      \
 		lib_ring_buffer_lost_event_too_big(__chan->chan);	      \
+		lttng_channel_event_lost(__chan, __event->id,		      \
+			smp_processor_id());				      \
 		goto __post;						      \
 	}								      \
 	__event_align = __event_get_align__##_name(tp_locvar, _args);         \
@@ -1226,6 +1236,14 @@ static void __event_probe__##_name(void *__data)			      \
 	__lpf = lttng_rcu_dereference(__session->pid_tracker);		      \
 	if (__lpf && likely(!lttng_pid_tracker_lookup(__lpf, current->pid)))  \
 		return;							      \
+	if (unlikely(__chan->ops->full_hint(__chan->chan,		      \
+			smp_processor_id()))) {				      \
+		__chan->ops->event_lost_full(__chan->chan,		      \
+			__event->priority ? RING_BUFFER_RFLAG_HIGH_PRIO : 0); \
+		lttng_channel_event_lost(__chan, __event->id,		      \
+			smp_processor_id());				      \
+		return;							      \
+	}								      \
 	__orig_dynamic_len_offset = this_cpu_ptr(&lttng_dynamic_len_stack)->offset; \
 	__dynamic_len_idx = __orig_dynamic_len_offset;			      \
 	_code_pre							      \
@@ -1246,6 +1264,8 @@ static void __event_probe__##_name(void *__data)			      \
 	__event_len = __event_get_size__##_name(tp_locvar);		      \
 	if (unlikely(__event_len < 0)) {				      \
 		lib_ring_buffer_lost_event_too_big(__chan->chan);	      \
+		lttng_channel_event_lost(__chan, __event->id,		      \
+			smp_processor_id());				      \
 		goto __post;						      \
 	}								      \
 	__event_align = __event_get_align__##_name(tp_locvar);		      \
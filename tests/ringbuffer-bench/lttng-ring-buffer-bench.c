@@ -0,0 +1,340 @@
+/*
+ * lttng-ring-buffer-bench.c
+ *
+ * Ring buffer reserve/commit throughput benchmark, with an optional consumer
+ * reading the buffers from another CPU. Comparing runs with and without the
+ * consumer shows the cost of the cache lines shared between the writers and
+ * the reader; run it under "perf c2c record" to see which lines bounce.
+ *
+ * Copyright (C) 2010-2012 Mathieu Desnoyers <mathieu.desnoyers@efficios.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; only
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <linux/module.h>
+#include <linux/types.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <wrapper/trace-clock.h>
+#include <lttng-tracer.h>
+
+static unsigned int nr_writers = 1;
+module_param(nr_writers, uint, 0444);
+MODULE_PARM_DESC(nr_writers,
+	"Number of writer threads, bound to CPUs 0 to nr_writers - 1");
+
+static unsigned int duration_ms = 1000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "Duration of the run, in milliseconds");
+
+static bool consumer = true;
+module_param(consumer, bool, 0444);
+MODULE_PARM_DESC(consumer,
+	"Run a consumer on the CPU following the writers (default: yes)");
+
+static bool overwrite;
+module_param(overwrite, bool, 0444);
+MODULE_PARM_DESC(overwrite, "Overwrite mode rather than discard mode");
+
+static bool snapshot;
+module_param(snapshot, bool, 0444);
+MODULE_PARM_DESC(snapshot,
+	"The consumer takes position snapshots, as a flight recorder snapshot reader, rather than getting sub-buffers");
+
+static unsigned int record_size = 16;
+module_param(record_size, uint, 0444);
+MODULE_PARM_DESC(record_size, "Payload size of each record, in bytes");
+
+static unsigned long subbuf_size = 16384;
+module_param(subbuf_size, ulong, 0444);
+MODULE_PARM_DESC(subbuf_size, "Sub-buffer size, in bytes (power of 2)");
+
+static unsigned long num_subbuf = 8;
+module_param(num_subbuf, ulong, 0444);
+MODULE_PARM_DESC(num_subbuf, "Number of sub-buffers (power of 2)");
+
+#define LTTNG_BENCH_RECORD_MAX	256
+#define LTTNG_BENCH_TSC_BITS	27	/* As the LTTng compact event header */
+
+struct lttng_bench_thread {
+	struct task_struct *task;
+	int cpu;
+	unsigned long long ok;		/* Records written, or sub-buffers read */
+	unsigned long long failed;	/* Reservations or gets which failed */
+};
+
+static struct channel *bench_chan;
+static const struct lib_ring_buffer_config *bench_config;
+
+static inline
+u64 lib_ring_buffer_clock_read(struct channel *chan)
+{
+	return trace_clock_read64();
+}
+
+static inline
+size_t record_header_size(const struct lib_ring_buffer_config *config,
+				 struct channel *chan, size_t offset,
+				 size_t *pre_header_padding,
+				 struct lib_ring_buffer_ctx *ctx)
+{
+	*pre_header_padding = 0;
+	return 0;
+}
+
+#include <wrapper/ringbuffer/api.h>
+
+static u64 client_ring_buffer_clock_read(struct channel *chan)
+{
+	return lib_ring_buffer_clock_read(chan);
+}
+
+static
+size_t client_record_header_size(const struct lib_ring_buffer_config *config,
+				 struct channel *chan, size_t offset,
+				 size_t *pre_header_padding,
+				 struct lib_ring_buffer_ctx *ctx)
+{
+	return record_header_size(config, chan, offset,
+				  pre_header_padding, ctx);
+}
+
+static size_t client_packet_header_size(void)
+{
+	return 0;
+}
+
+static void client_buffer_begin(struct lib_ring_buffer *buf, u64 tsc,
+				unsigned int subbuf_idx)
+{
+}
+
+static void client_buffer_end(struct lib_ring_buffer *buf, u64 tsc,
+			      unsigned int subbuf_idx, unsigned long data_size)
+{
+}
+
+/*
+ * Same settings as the per-cpu LTTng clients, except for the IPI barrier:
+ * the reader IPIs would hide the cache line traffic being measured.
+ */
+#define LTTNG_BENCH_CONFIG(_mode)					\
+	{								\
+		.cb.ring_buffer_clock_read = client_ring_buffer_clock_read, \
+		.cb.record_header_size = client_record_header_size,	\
+		.cb.subbuffer_header_size = client_packet_header_size,	\
+		.cb.buffer_begin = client_buffer_begin,			\
+		.cb.buffer_end = client_buffer_end,			\
+									\
+		.tsc_bits = LTTNG_BENCH_TSC_BITS,			\
+		.alloc = RING_BUFFER_ALLOC_PER_CPU,			\
+		.sync = RING_BUFFER_SYNC_PER_CPU,			\
+		.mode = _mode,						\
+		.backend = RING_BUFFER_PAGE,				\
+		.output = RING_BUFFER_SPLICE,				\
+		.oops = RING_BUFFER_OOPS_CONSISTENCY,			\
+		.ipi = RING_BUFFER_NO_IPI_BARRIER,			\
+		.wakeup = RING_BUFFER_WAKEUP_BY_TIMER,			\
+	}
+
+static const struct lib_ring_buffer_config bench_discard_config =
+	LTTNG_BENCH_CONFIG(RING_BUFFER_DISCARD);
+static const struct lib_ring_buffer_config bench_overwrite_config =
+	LTTNG_BENCH_CONFIG(RING_BUFFER_OVERWRITE);
+
+static
+int lttng_bench_writer(void *data)
+{
+	struct lttng_bench_thread *thread = data;
+	const struct lib_ring_buffer_config *config = bench_config;
+	char payload[LTTNG_BENCH_RECORD_MAX] = { 0 };
+	unsigned long iter = 0;
+
+	while (!kthread_should_stop()) {
+		struct lib_ring_buffer_ctx ctx;
+		int cpu, ret;
+
+		cpu = lib_ring_buffer_get_cpu(config);
+		if (cpu < 0)
+			continue;
+		lib_ring_buffer_ctx_init(&ctx, bench_chan, NULL, record_size,
+					 sizeof(char), cpu);
+		ret = lib_ring_buffer_reserve(config, &ctx);
+		if (likely(!ret)) {
+			lib_ring_buffer_backend_get_pages(config, &ctx,
+					&ctx.backend_pages);
+			lib_ring_buffer_write(config, &ctx, payload,
+					      record_size);
+			lib_ring_buffer_commit(config, &ctx);
+			thread->ok++;
+		} else {
+			thread->failed++;
+		}
+		lib_ring_buffer_put_cpu(config);
+		if (!(++iter & 0xFFF))
+			cond_resched();
+	}
+	return 0;
+}
+
+static
+int lttng_bench_consumer(void *data)
+{
+	struct lttng_bench_thread *thread = data;
+	unsigned int i;
+
+	while (!kthread_should_stop()) {
+		for (i = 0; i < nr_writers; i++) {
+			struct lib_ring_buffer *buf =
+				channel_get_ring_buffer(bench_config,
+							bench_chan, i);
+			unsigned long consumed, produced;
+
+			if (snapshot) {
+				if (!lib_ring_buffer_snapshot(buf, &consumed,
+							      &produced))
+					thread->ok++;
+				else
+					thread->failed++;
+			} else if (!lib_ring_buffer_get_next_subbuf(buf)) {
+				lib_ring_buffer_put_next_subbuf(buf);
+				thread->ok++;
+			} else {
+				thread->failed++;
+			}
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static
+int lttng_bench_start(struct lttng_bench_thread *thread,
+		      int (*fn)(void *data), const char *name)
+{
+	thread->task = kthread_create_on_node(fn, thread,
+			cpu_to_node(thread->cpu), "%s/%d", name, thread->cpu);
+	if (IS_ERR(thread->task))
+		return PTR_ERR(thread->task);
+	kthread_bind(thread->task, thread->cpu);
+	return 0;
+}
+
+static
+int lttng_bench_run(void)
+{
+	struct lttng_bench_thread *writers, reader;
+	unsigned long long total = 0, failed = 0;
+	unsigned int i, nr_started = 0;
+	int ret = 0;
+
+	writers = kcalloc(nr_writers, sizeof(*writers), GFP_KERNEL);
+	if (!writers)
+		return -ENOMEM;
+	memset(&reader, 0, sizeof(reader));
+	for (i = 0; i < nr_writers; i++) {
+		writers[i].cpu = i;
+		ret = lttng_bench_start(&writers[i], lttng_bench_writer,
+					"lttng_bench_writer");
+		if (ret)
+			goto end;
+		nr_started++;
+	}
+	if (consumer) {
+		reader.cpu = nr_writers;
+		ret = lttng_bench_start(&reader, lttng_bench_consumer,
+					"lttng_bench_consumer");
+		if (ret)
+			goto end;
+		wake_up_process(reader.task);
+	}
+	for (i = 0; i < nr_writers; i++)
+		wake_up_process(writers[i].task);
+	msleep(duration_ms);
+end:
+	for (i = 0; i < nr_started; i++) {
+		/* Threads which were not woken up return without running. */
+		kthread_stop(writers[i].task);
+		total += writers[i].ok;
+		failed += writers[i].failed;
+	}
+	if (reader.task && !IS_ERR(reader.task))
+		kthread_stop(reader.task);
+	kfree(writers);
+	if (ret)
+		return ret;
+
+	printk(KERN_INFO "LTTng ring buffer bench: %s mode, %u writer(s), "
+		"%u bytes records, %s consumer\n",
+		overwrite ? "overwrite" : "discard", nr_writers, record_size,
+		consumer ? (snapshot ? "with snapshot" : "with") : "without");
+	printk(KERN_INFO "LTTng ring buffer bench: %llu records/s, "
+		"%llu failed reservations/s, %llu %s/s\n",
+		div_u64(total * MSEC_PER_SEC, duration_ms),
+		div_u64(failed * MSEC_PER_SEC, duration_ms),
+		div_u64(reader.ok * MSEC_PER_SEC, duration_ms),
+		snapshot ? "snapshots" : "sub-buffers read");
+	return 0;
+}
+
+static
+int __init lttng_ring_buffer_bench_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (!nr_writers || !duration_ms
+	    || nr_writers + consumer > num_online_cpus()
+	    || record_size > LTTNG_BENCH_RECORD_MAX)
+		return -EINVAL;
+	for (i = 0; i < nr_writers + consumer; i++) {
+		if (!cpu_online(i))
+			return -EINVAL;
+	}
+	bench_config = overwrite ? &bench_overwrite_config
+				 : &bench_discard_config;
+	bench_chan = channel_create(bench_config, "lttng-ring-buffer-bench",
+				    NULL, NULL, subbuf_size, num_subbuf, 1,
+				    0, 0, 0);
+	if (!bench_chan)
+		return -EINVAL;
+	for (i = 0; consumer && i < nr_writers; i++) {
+		ret = lib_ring_buffer_open_read(channel_get_ring_buffer(
+				bench_config, bench_chan, i));
+		if (ret)
+			goto error;
+	}
+	ret = lttng_bench_run();
+error:
+	while (consumer && i-- > 0)
+		lib_ring_buffer_release_read(channel_get_ring_buffer(
+				bench_config, bench_chan, i));
+	channel_destroy(bench_chan);
+	/* The results are in the kernel log, nothing stays loaded. */
+	return ret ? ret : -EAGAIN;
+}
+module_init(lttng_ring_buffer_bench_init);
+
+static
+void __exit lttng_ring_buffer_bench_exit(void)
+{
+}
+module_exit(lttng_ring_buffer_bench_exit);
+
+MODULE_LICENSE("GPL and additional rights");
+MODULE_AUTHOR("Mathieu Desnoyers <mathieu.desnoyers@efficios.com>");
+MODULE_DESCRIPTION("LTTng ring buffer reserve/commit benchmark");